@@ -21,4 +21,68 @@ def wrap(f):
   wrapper.func_name = f.func_name
   return wrapper
 
-    
+def jit(f):
+  '''Function decorator.
+
+  Like wrap, but also translates the function to native code.  Functions the
+  JIT can't handle are interpreted as usual, as is everything unless falcon
+  was built with the (experimental) JIT enabled.
+  '''
+  evaluator.jit_compile(f)
+  return wrap(f)
+
+
+def enable_profiling(on=True):
+  '''Record operation counts, cycle costs and pairs for the default evaluator.
+
+  Profiling can also be enabled for every evaluator by setting FALCON_PROFILE
+  in the environment.
+  '''
+  evaluator.enable_profiling(on)
+
+def clear_profile():
+  evaluator.clear_profile()
+
+def op_profile(e=None):
+  '''The profile collected so far, as a dict:
+
+    counts: operation name -> times dispatched
+    cycles: operation name -> average cycles (from sampled dispatches)
+    pairs: (first, second) -> times second was dispatched right after first
+  '''
+  return (e or evaluator).op_profile()
+
+def call_stats(e=None):
+  '''How often call sites found their callee's code cached:
+
+    hits: calls which reused the code cached for the site
+    misses: calls which had to look it up
+  '''
+  return (e or evaluator).call_stats()
+
+def hint_stats(f, e=None):
+  '''How well each site in f's code with an inline cache (attribute accesses,
+  global loads, calls and arithmetic) used it, as a list of dicts:
+
+    index: the site's instruction index
+    op: its operation
+    name: the attribute or global name, or None
+    hits: times it found what it needed cached
+    misses: times it had to look it up
+    entries: how many types (or functions) it has cached
+    megamorphic: whether it saw too many to cache, and gave up
+  '''
+  return (e or evaluator).hint_stats(f)
+
+def print_op_profile(e=None, limit=20, out=sys.stderr):
+  profile = op_profile(e)
+  counts = profile['counts']
+  cycles = profile['cycles']
+  total = float(sum(counts.values()) or 1)
+  print >>out, '%-30s %12s %7s %9s' % ('operation', 'count', '%', 'cycles')
+  for name, count in sorted(counts.items(), key=lambda kv: -kv[1])[:limit]:
+    print >>out, '%-30s %12d %6.2f%% %9.1f' % (name, count, 100 * count / total, cycles.get(name, 0))
+  print >>out
+  print >>out, '%-61s %12s' % ('pair', 'count')
+  for pair, count in sorted(profile['pairs'].items(), key=lambda kv: -kv[1])[:limit]:
+    print >>out, '%-61s %12d' % ('%s -> %s' % pair, count)
@@ -21,7 +21,11 @@ def main():
   d['__builtins__'] = __builtins__
   d['__file__'] = script 
   e = falcon.Evaluator()
-  e.eval_python_module(code, d)
+  try:
+    e.eval_python_module(code, d)
+  finally:
+    if os.environ.get('FALCON_PROFILE'):
+      falcon.print_op_profile(e)
   
 if __name__ == '__main__':
   main()
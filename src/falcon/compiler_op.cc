@@ -5,6 +5,10 @@ std::string CompilerOp::str() const {
     return StringPrintf("r%d = r%d", regs[1], regs[0]);
   }
 
+  if (code == MOVE) {
+    return StringPrintf("r%d = r%d%s", regs[1], regs[0], arg ? " (move)" : "");
+  }
+
   StringWriter w;
   int num_args = regs.size();
   if (has_dest) {
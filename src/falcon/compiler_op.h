@@ -5,6 +5,7 @@
 #include <string>
 
 #include "rexcept.h"
+#include "oputil.h"
 
 #define COMPILE_LOG(...) do { if (getenv("COMPILE_LOG")) { Log_Info(__VA_ARGS__); } } while (0)
 
@@ -40,8 +41,20 @@ struct CompilerOp {
     return this->regs[n_regs - 1];
   }
 
+  // MOVE_N, UNPACK_SEQUENCE and LOAD_METHOD write every register after their
+  // inputs, instead of a single destination.
+  bool has_dests() const {
+    return this->code == MOVE_N || this->code == UNPACK_SEQUENCE || this->code == LOAD_METHOD;
+  }
+
   size_t num_inputs() {
     size_t n = this->regs.size();
+    if (this->code == MOVE_N) {
+      return n / 2;
+    }
+    if (this->code == UNPACK_SEQUENCE || this->code == LOAD_METHOD) {
+      return 1;
+    }
     // if one of the registers is a target for a store, don't count it as an input
     return this->has_dest ? n - 1 : n;
   }
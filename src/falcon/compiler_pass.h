@@ -51,7 +51,7 @@ class BackwardPass: public CompilerPass {
 public:
   void visit_bb(BasicBlock* bb) {
     size_t n_ops = bb->code.size();
-    for (size_t i = n_ops - 1; i-- > 0;) {
+    for (size_t i = n_ops; i-- > 0;) {
       CompilerOp* op = bb->code[i];
       if (!op->dead) {
         this->visit_op(op);
@@ -65,7 +65,7 @@ public:
       fn->bbs[i]->visited = false;
     }
 
-    for (size_t i = n_bbs - 1; i-- > 0;) {
+    for (size_t i = n_bbs; i-- > 0;) {
       BasicBlock* bb = fn->bbs[i];
       if (!bb->visited && !bb->dead) {
         this->visit_bb(bb);
@@ -4,6 +4,7 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <set>
 
 #include "py_include.h"
 
@@ -21,6 +22,15 @@ public:
   int num_consts;
   int num_locals;
 
+  // The argument window for calls (see ArgumentWindows): the register
+  // reserved for self, followed by window_size - 1 argument registers; -1 if
+  // there are no calls to make.
+  int window;
+  int window_size;
+
+  // The constants given registers by RenameRegisters, in register order.
+  std::vector<int> used_consts;
+
   PyCodeObject* py_code;
   PyObject* consts_tuple;
   unsigned char* py_codestr;
@@ -30,8 +40,18 @@ public:
 
   std::map<int, BasicBlock*> bb_offsets;
 
+  // Offsets of bytecodes which something jumps to.
+  std::set<int> jump_targets;
+
+  // Used by registerize to spot `for x in range(...)` loops: registers
+  // loaded from the globals range/xrange, calls through them, and the stop
+  // register for each counted loop.
+  std::set<int> range_fns;
+  std::map<int, CompilerOp*> range_calls;
+  std::map<int, int> range_stops;
+
   CompilerState() :
-      num_reg(0), num_consts(0), num_locals(0),
+      num_reg(0), num_consts(0), num_locals(0), window(-1), window_size(0),
       py_code(NULL),  consts_tuple(NULL),
       py_codestr(NULL), py_codelen(0),
       names(NULL) { }
@@ -45,6 +65,8 @@ public:
     num_locals = code->co_nlocals;
     // Offset by the number of constants and locals.
     num_reg = num_consts + num_locals;
+    window = -1;
+    window_size = 0;
 //    Log_Info("Consts: %d, locals: %d, first register: %d", num_consts, num_locals, num_reg);
 
     py_codelen = codelen;
@@ -60,6 +82,20 @@ public:
     }
   }
 
+  // Register layout: [locals][consts][temporaries].  Arguments are the first
+  // locals, so a frame can start where its caller left the arguments.
+  int local_reg(int i) const {
+    return i;
+  }
+
+  int const_reg(int i) const {
+    return num_locals + i;
+  }
+
+  bool is_const_reg(int reg) const {
+    return reg >= num_locals && reg < num_locals + num_consts;
+  }
+
   int num_ops() {
     int total = 0;
     for (auto bb : bbs) {
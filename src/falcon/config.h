@@ -5,10 +5,6 @@
 // These defines enable/disable certain optimizations in the
 // evaluator:
 
-#ifndef STACK_ALLOC_REGISTERS
-#define STACK_ALLOC_REGISTERS 1
-#endif
-
 #ifndef PACK_INSTRUCTIONS
 #define PACK_INSTRUCTIONS 1
 #endif
@@ -33,6 +29,31 @@
 #define USE_THREADED_DISPATCH 1
 #endif
 
+#ifndef USE_TAILCALL_DISPATCH
+// Run each operation in its own function, which tail-calls the handler for
+// the next instruction, in place of the computed goto loop in
+// Evaluator::eval.  Needs a compiler with musttail, or optimization enabled.
+#define USE_TAILCALL_DISPATCH 0
+#endif
+
+#ifndef DIRECT_THREADING
+// Store each handler's address in the instruction itself, and jump targets
+// as absolute addresses.  Requires USE_THREADED_DISPATCH or
+// USE_TAILCALL_DISPATCH.
+#define DIRECT_THREADING (USE_THREADED_DISPATCH || USE_TAILCALL_DISPATCH)
+#endif
+
+#ifndef ENABLE_JIT
+// Allow functions to be translated to native code (see rjit.h).  Experimental,
+// and only for x86-64 Linux: the native code just calls the dispatch loop's
+// handlers, and is no faster than the dispatch loop yet.
+#define ENABLE_JIT 0
+#endif
+
+#if ENABLE_JIT && !(defined(__x86_64__) && defined(__linux__))
+#error "ENABLE_JIT needs x86-64 Linux"
+#endif
+
 #ifndef MAX_REGISTERS
 // will fail for sufficiently large functions without CompactRegisters opt
 #define MAX_REGISTERS 1024
@@ -2,6 +2,7 @@
 #define FALCON_OPTIMIZATIONS_H
 
 #include <map>
+#include <set>
 
 #include "opcode.h"
 #include "util.h"
@@ -36,6 +37,7 @@ protected:
     case LOAD_CONST:
     case LOAD_NAME:
     case STORE_FAST:
+    case MOVE:
     case STORE_DEREF:
     case BUILD_SLICE:
     case CONST_INDEX:
@@ -122,7 +124,24 @@ public:
   }
 };
 
+static inline bool is_copy(int op_code) {
+  return op_code == LOAD_FAST || op_code == STORE_FAST || op_code == LOAD_CONST || op_code == MOVE;
+}
+
 class CopyPropagation: public CompilerPass {
+private:
+  // `reg` is being overwritten: forget copies to and from it.
+  void invalidate(std::map<int, int>& env, int reg) {
+    env.erase(reg);
+    for (auto iter = env.begin(); iter != env.end();) {
+      if (iter->second == reg) {
+        env.erase(iter++);
+      } else {
+        ++iter;
+      }
+    }
+  }
+
 public:
   void visit_bb(BasicBlock* bb) {
     std::map<int, int> env;
@@ -139,28 +158,56 @@ public:
           op->regs[reg_idx] = iter->second;
         }
       }
-      if (op->code == LOAD_FAST || op->code == STORE_FAST || op->code == LOAD_CONST) {
-        source = op->regs[0];
-        target = op->regs[1];
-        auto iter = env.find(source);
-        if (iter != env.end()) {
-          source = iter->second;
+
+      if (op->has_dests()) {
+        std::set<int> dests(op->regs.begin() + n_inputs, op->regs.end());
+        for (int dest : dests) {
+          invalidate(env, dest);
+        }
+        // A source which is also a destination is overwritten by the move.
+        for (size_t reg_idx = 0; op->code == MOVE_N && reg_idx < n_inputs; reg_idx++) {
+          source = op->regs[reg_idx];
+          if (dests.find(source) == dests.end()) {
+            env[op->regs[n_inputs + reg_idx]] = source;
+          }
+        }
+      } else if (op->has_dest) {
+        target = op->regs[n_inputs];
+        invalidate(env, target);
+        if (is_copy(op->code)) {
+          source = op->regs[0];
+          if (source != target) {
+            env[target] = source;
+          }
         }
-        env[target] = source;
       }
     }
   }
 };
 
 class StoreElim: public CompilerPass, UseCounts {
+private:
+  // Is `reg` mentioned by any of the operations in (start, end)?
+  bool used_between(BasicBlock* bb, size_t start, size_t end, int reg) {
+    for (size_t i = start + 1; i < end; ++i) {
+      const std::vector<int>& regs = bb->code[i]->regs;
+      if (std::find(regs.begin(), regs.end(), reg) != regs.end()) {
+        return true;
+      }
+    }
+    return false;
+  }
+
 public:
   void visit_bb(BasicBlock* bb) {
-    // map from registers to their last definition in the basic block
-    std::map<int, CompilerOp*> env;
+    // map from registers to their last definition in the basic block: the
+    // index of the operation, and the position of the register in it
+    std::map<int, std::pair<size_t, size_t> > env;
 
     // if we encounter a move X->Y when:
     //   - X is locally defined in the basic block
     //   - X is only used once (for this move)
+    //   - Y isn't read or written between the definition and the move
     // then modify the defining instruction of X
     // to directly write to Y and mark the move X->Y as dead
 
@@ -171,17 +218,28 @@ public:
       // check all the registers and forward any that are in the env
       size_t n_inputs = op->num_inputs();
 
-      if (op->has_dest) {
+      if (op->has_dests()) {
+        for (size_t reg_idx = n_inputs; reg_idx < op->regs.size(); ++reg_idx) {
+          env[op->regs[reg_idx]] = std::make_pair(i, reg_idx);
+        }
+      } else if (op->has_dest) {
         target = op->regs[n_inputs];
-        env[target] = op;
+        env[target] = std::make_pair(i, n_inputs);
 
-        if (op->code == LOAD_FAST || op->code == STORE_FAST) {
+        if (is_copy(op->code) && op->code != LOAD_CONST) {
           source = op->regs[0];
           auto iter = env.find(source);
-          if (iter != env.end() && this->get_count(source) == 1) {
-            CompilerOp* def = iter->second;
-            def->regs[def->num_inputs()] = target;
+          if (iter != env.end() && this->get_count(source) == 1 &&
+              !used_between(bb, iter->second.first, i, target)) {
+            CompilerOp* def = bb->code[iter->second.first];
+            // An operation writing several registers can't write one twice.
+            if (def->has_dests() && std::find(def->regs.begin() + def->num_inputs(), def->regs.end(), target)
+                != def->regs.end()) {
+              continue;
+            }
+            def->regs[iter->second.second] = target;
             op->dead = true;
+            env[target] = iter->second;
           }
         }
       }
@@ -194,6 +252,254 @@ public:
   }
 };
 
+// Once everything else is done, let moves take over the reference held by a
+// temporary they read for the last time, instead of incref'ing the value and
+// leaving the temporary to be released when it is next overwritten.
+//
+// We only do this for temporaries defined earlier in the same block and used
+// nowhere else, so the move can't run again without the definition running
+// first.
+class TransferOwnership: public CompilerPass, UseCounts {
+private:
+  int num_variables;
+  std::set<int> defs;
+
+  bool is_dead_after(int reg) {
+    return reg >= num_variables && this->get_count(reg) == 1 && defs.find(reg) != defs.end();
+  }
+
+public:
+  void visit_op(CompilerOp* op) {
+    size_t n_inputs = op->num_inputs();
+    if (op->code == MOVE) {
+      if (is_dead_after(op->regs[0])) {
+        op->arg = 1;
+      }
+    } else if (op->code == MOVE_N) {
+      for (size_t i = 0; i < n_inputs; ++i) {
+        if (is_dead_after(op->regs[i])) {
+          op->arg |= 1 << i;
+        }
+      }
+    }
+
+    if (op->has_dests()) {
+      defs.insert(op->regs.begin() + n_inputs, op->regs.end());
+    } else if (op->has_dest) {
+      defs.insert(op->regs[n_inputs]);
+    }
+  }
+
+  void visit_bb(BasicBlock* bb) {
+    defs.clear();
+    CompilerPass::visit_bb(bb);
+  }
+
+  void visit_fn(CompilerState* fn) {
+    num_variables = fn->num_consts + fn->num_locals;
+    this->count_uses(fn);
+    CompilerPass::visit_fn(fn);
+  }
+};
+
+// Replace a COMPARE_OP whose result is only used by the conditional jump
+// following it with a single COMPARE_AND_BRANCH, so the comparison never
+// materializes a bool.
+class CompareAndBranch: public CompilerPass, UseCounts {
+public:
+  void visit_bb(BasicBlock* bb) {
+    size_t n_ops = bb->code.size();
+    if (n_ops < 2) {
+      return;
+    }
+
+    CompilerOp* cmp = bb->code[n_ops - 2];
+    CompilerOp* jmp = bb->code[n_ops - 1];
+    if (cmp->dead || cmp->code != COMPARE_OP) {
+      return;
+    }
+    if (jmp->code != POP_JUMP_IF_FALSE && jmp->code != POP_JUMP_IF_TRUE) {
+      return;
+    }
+
+    int result = cmp->regs[cmp->num_inputs()];
+    if (jmp->regs[0] != result || this->get_count(result) != 1) {
+      return;
+    }
+
+    jmp->code = jmp->code == POP_JUMP_IF_FALSE ? COMPARE_AND_BRANCH_FALSE : COMPARE_AND_BRANCH_TRUE;
+    jmp->arg = cmp->arg;
+    jmp->regs.clear();
+    jmp->regs.push_back(cmp->regs[0]);
+    jmp->regs.push_back(cmp->regs[1]);
+    cmp->dead = true;
+  }
+
+  void visit_fn(CompilerState* fn) {
+    this->count_uses(fn);
+    CompilerPass::visit_fn(fn);
+  }
+};
+
+// Call methods without binding them: a LOAD_ATTR whose result is only used as
+// the function of the CALL_FUNCTION following it becomes LOAD_METHOD, which
+// gives the call self in a register of its own (see oputil.h).
+class MethodCalls: public CompilerPass, UseCounts {
+private:
+  int num_variables_;
+  CompilerState* fn_;
+
+  // The LOAD_ATTR computing the function for the call at `call_idx`.
+  CompilerOp* attr_def(BasicBlock* bb, size_t call_idx, int reg) {
+    if (reg < num_variables_ || this->get_count(reg) != 1) {
+      return NULL;
+    }
+    for (size_t i = call_idx; i-- > 0;) {
+      CompilerOp* op = bb->code[i];
+      if (op->dead) {
+        continue;
+      }
+      if (op->has_dest && op->dest() == reg) {
+        return op->code == LOAD_ATTR ? op : NULL;
+      }
+      if (op->has_dests() &&
+          std::find(op->regs.begin() + op->num_inputs(), op->regs.end(), reg) != op->regs.end()) {
+        return NULL;
+      }
+    }
+    return NULL;
+  }
+
+public:
+  void visit_bb(BasicBlock* bb) {
+    for (size_t i = 0; i < bb->code.size(); ++i) {
+      CompilerOp* call = bb->code[i];
+      if (call->dead || call->code != CALL_FUNCTION) {
+        continue;
+      }
+      CompilerOp* load = attr_def(bb, i, call->regs[0]);
+      if (load == NULL) {
+        continue;
+      }
+      int self = fn_->num_reg++;
+      load->code = LOAD_METHOD;
+      load->has_dest = false;
+      load->regs.push_back(self);
+      call->code = CALL_METHOD;
+      call->regs.insert(call->regs.begin() + 1, self);
+    }
+  }
+
+  void visit_fn(CompilerState* fn) {
+    this->count_uses(fn);
+    num_variables_ = fn->num_consts + fn->num_locals;
+    fn_ = fn;
+    CompilerPass::visit_fn(fn);
+  }
+};
+
+// Give calls their arguments in a contiguous window at the end of the
+// register file, shared by every call in the function: a register for self,
+// then one per argument.  The callee's registers start in the window (at
+// self for a bound method or CALL_METHOD, else at the first argument), so
+// its parameters are the registers its caller filled in.
+//
+// An argument computed into a temporary just for the call is computed
+// straight into the window, as long as no other call uses the window in
+// between.  Anything else (variables, mostly) is left where it is, and the
+// call copies it in.
+class ArgumentWindows: public CompilerPass, UseCounts {
+private:
+  int num_variables_;
+  int window_;
+  int max_args_;
+
+  bool writes(CompilerOp* op, int reg) {
+    size_t n_inputs = op->num_inputs();
+    if (op->has_dests() || op->has_dest) {
+      return std::find(op->regs.begin() + n_inputs, op->regs.end(), reg) != op->regs.end();
+    }
+    return false;
+  }
+
+  // The operation computing `reg` for the call at `call_idx`, if it can
+  // write the window instead: it's the last definition of a temporary used
+  // only here, and no earlier call uses the window after it.  (The last call
+  // may itself be the definition: it's done with the window by the time it
+  // stores its result.)
+  CompilerOp* window_def(BasicBlock* bb, size_t start, size_t call_idx, int reg) {
+    if (reg < num_variables_ || reg >= window_ || this->get_count(reg) != 1) {
+      return NULL;
+    }
+    for (size_t i = call_idx; i-- > start;) {
+      CompilerOp* op = bb->code[i];
+      if (!op->dead && writes(op, reg)) {
+        return op->has_dests() && op->code != LOAD_METHOD ? NULL : op;
+      }
+    }
+    return NULL;
+  }
+
+  // Have def write window register `slot` in place of reg.
+  void retarget(CompilerOp* def, int reg, int slot) {
+    std::replace(def->regs.begin() + def->num_inputs(), def->regs.end(), reg, slot);
+  }
+
+public:
+  void visit_bb(BasicBlock* bb) {
+    size_t start = 0;
+    for (size_t i = 0; i < bb->code.size(); ++i) {
+      CompilerOp* call = bb->code[i];
+      if (call->dead || (call->arg >> 8) != 0) {
+        continue;
+      }
+      // SETUP_RANGE calls through the window when range isn't the builtin,
+      // so it needs the room, but its arguments stay where they are.
+      if (call->code == SETUP_RANGE) {
+        max_args_ = std::max(max_args_, call->arg & 0xff);
+        start = i;
+        continue;
+      }
+      if (call->code != CALL_FUNCTION && call->code != CALL_METHOD) {
+        continue;
+      }
+      // CALL_METHOD's self goes in the window's self register.
+      int first = 1;
+      if (call->code == CALL_METHOD) {
+        CompilerOp* def = window_def(bb, start, i, call->regs[1]);
+        if (def != NULL) {
+          retarget(def, call->regs[1], window_);
+          call->regs[1] = window_;
+        }
+        first = 2;
+      }
+      int na = call->arg & 0xff;
+      for (int j = 0; j < na; ++j) {
+        int reg = call->regs[first + j];
+        CompilerOp* def = window_def(bb, start, i, reg);
+        if (def != NULL) {
+          retarget(def, reg, window_ + 1 + j);
+          call->regs[first + j] = window_ + 1 + j;
+        }
+      }
+      max_args_ = std::max(max_args_, na);
+      start = i;
+    }
+  }
+
+  void visit_fn(CompilerState* fn) {
+    this->count_uses(fn);
+    num_variables_ = fn->num_consts + fn->num_locals;
+    window_ = fn->num_reg;
+    max_args_ = -1;
+    CompilerPass::visit_fn(fn);
+    if (max_args_ >= 0) {
+      fn->window = window_;
+      fn->window_size = max_args_ + 1;
+      fn->num_reg += fn->window_size;
+    }
+  }
+};
 
 class RenameRegisters: public CompilerPass {
   // simple renaming that ignore live ranges of registers
@@ -233,18 +539,36 @@ public:
     // A few fixed-register opcodes special case the invalid register.
     register_map_[-1] = -1;
 
-    // Don't remap the const/local register aliases, even if we
-    // don't see a usage point for them.
-    for (int i = 0; i < fn->num_consts + fn->num_locals; ++i) {
+    // Don't remap the local register aliases, even if we don't see a usage
+    // point for them.
+    for (int i = 0; i < fn->num_locals; ++i) {
       register_map_[i] = i;
     }
 
-    int curr = fn->num_consts + fn->num_locals;
-    for (int i = fn->num_consts + fn->num_locals; i < fn->num_reg; ++i) {
+    // Constants follow, but only the ones we use: frames copy them in.
+    int curr = fn->num_locals;
+    fn->used_consts.clear();
+    for (int i = 0; i < fn->num_consts; ++i) {
+      if (counts[fn->const_reg(i)] != 0) {
+        register_map_[fn->const_reg(i)] = curr++;
+        fn->used_consts.push_back(i);
+      }
+    }
+
+    // The argument window stays in one piece, at the end.
+    int num_temps = fn->window >= 0 ? fn->window : fn->num_reg;
+    for (int i = fn->num_consts + fn->num_locals; i < num_temps; ++i) {
       if (counts[i] != 0) {
         register_map_[i] = curr++;
       }
     }
+    if (fn->window >= 0) {
+      for (int i = 0; i < fn->window_size; ++i) {
+        register_map_[fn->window + i] = curr + i;
+      }
+      fn->window = curr;
+      curr += fn->window_size;
+    }
 
     int min_count = 0;
     for (int i = 0; i < fn->num_reg; ++i) {
@@ -466,15 +790,16 @@ public:
     for (int i = 0; i < fn->num_consts; ++i) {
       PyObject* obj = PyTuple_GetItem(fn->consts_tuple, i);
 
+      int reg = fn->const_reg(i);
       if (PyInt_CheckExact(obj)) {
-        this->update_type(i, INT);
+        this->update_type(reg, INT);
       } else if (PyFloat_CheckExact(obj)) {
-        this->update_type(i, FLOAT);
+        this->update_type(reg, FLOAT);
       } else if (PyBool_Check(obj)) {
-        this->update_type(i, BOOL);
+        this->update_type(reg, BOOL);
       }
       else {
-        this->update_type(i, OBJ);
+        this->update_type(reg, OBJ);
       }
     }
     size_t n_bbs = fn->bbs.size();
@@ -502,8 +827,8 @@ public:
             break;
           case LOAD_FAST: {
             int src_reg = op->regs[0];
-            if (src_reg < fn->num_consts) {
-              PyObject* const_obj = PyTuple_GetItem(fn->consts_tuple, src_reg);
+            if (fn->is_const_reg(src_reg)) {
+              PyObject* const_obj = PyTuple_GetItem(fn->consts_tuple, src_reg - fn->num_locals);
 
               if (PyInt_CheckExact(const_obj)) {
                 t = INT;
@@ -519,6 +844,10 @@ public:
             break;
           }
           this->update_type(dest, t);
+        } else if (op->has_dests()) {
+          for (size_t i = n_inputs; i < op->regs.size(); ++i) {
+            this->update_type(op->regs[i], OBJ);
+          }
         }
       }
     }
@@ -561,6 +890,19 @@ public:
   void visit_op(CompilerOp* op) {
 
     size_t n_inputs = op->num_inputs();
+    if (op->code == MOVE_N) {
+      for (size_t i = n_inputs; i < op->regs.size(); ++i) {
+        if (this->get_count(op->regs[i]) != 0) {
+          return;
+        }
+      }
+      op->dead = true;
+      for (size_t input_idx = 0; input_idx < n_inputs; ++input_idx) {
+        this->decr_count(op->regs[input_idx]);
+      }
+      return;
+    }
+
     if ((n_inputs > 0) && (op->has_dest)) {
       int dest = op->regs[n_inputs];
       if (this->get_count(dest) == 0 &&
@@ -705,6 +1047,98 @@ public:
   }
 };
 
+/*
+ * Rewrite frequently executed pairs of operations into superinstructions.
+ *
+ * Only the code of the first operation changes; the second operation keeps
+ * its encoding, so anything else jumping to it still works.  The fused
+ * handler runs the second operation directly when control reaches it,
+ * saving one dispatch.
+ *
+ * Besides adjacent pairs within a block, we fuse a branch with the first
+ * operation of the block it transfers to: the loop back-edge
+ * (JUMP_ABSOLUTE -> FOR_ITER/FOR_RANGE) and the loop body entry
+ * (FOR_ITER/FOR_RANGE -> MOVE).
+ *
+ * Compares feeding a branch are handled separately by CompareAndBranch.
+ */
+class FuseSuperinstructions: public CompilerPass {
+private:
+  // FOR_ITER/FOR_RANGE operations already fused into a back-edge; we leave them alone
+  // so the jump keeps its fast path.
+  std::set<CompilerOp*> targets_;
+
+  static int fused_code(int first, int second) {
+    if (first == LOAD_GLOBAL && second == CALL_FUNCTION) return LOAD_GLOBAL_CALL_FUNCTION;
+    if (first == LOAD_ATTR && second == CALL_FUNCTION) return LOAD_ATTR_CALL_FUNCTION;
+    if (first == LOAD_METHOD && second == CALL_METHOD) return LOAD_METHOD_CALL_METHOD;
+    if (first == MOVE && second == COMPARE_AND_BRANCH_FALSE) return MOVE_COMPARE_AND_BRANCH;
+    if (first == FOR_ITER && second == MOVE) return FOR_ITER_MOVE;
+    if (first == JUMP_ABSOLUTE && second == FOR_ITER) return JUMP_ABSOLUTE_FOR_ITER;
+    if (first == FOR_RANGE && second == MOVE) return FOR_RANGE_MOVE;
+    if (first == JUMP_ABSOLUTE && second == FOR_RANGE) return JUMP_ABSOLUTE_FOR_RANGE;
+    return -1;
+  }
+
+  CompilerOp* first_op(BasicBlock* bb) {
+    if (bb == NULL || bb->code.empty()) {
+      return NULL;
+    }
+    return bb->code[0];
+  }
+
+  void fuse(CompilerOp* a, CompilerOp* b) {
+    if (b == NULL) {
+      return;
+    }
+    int code = fused_code(a->code, b->code);
+    if (code != -1) {
+      a->code = code;
+    }
+  }
+
+public:
+  void visit_fn(CompilerState* fn) {
+    // Back-edges first: these execute once per loop iteration.
+    for (size_t i = 0; i < fn->bbs.size(); ++i) {
+      BasicBlock* bb = fn->bbs[i];
+      if (bb->code.empty()) {
+        continue;
+      }
+      CompilerOp* last = bb->code.back();
+      if (last->code == JUMP_ABSOLUTE) {
+        CompilerOp* target = first_op(bb->exits[0]);
+        if (target != NULL && (target->code == FOR_ITER || target->code == FOR_RANGE)) {
+          fuse(last, target);
+          targets_.insert(target);
+        }
+      }
+    }
+
+    // Walk each block backwards, so an operation which is the first half of a
+    // pair (and so no longer has its original code) is not also used as the
+    // second half of the pair before it.
+    for (size_t i = 0; i < fn->bbs.size(); ++i) {
+      BasicBlock* bb = fn->bbs[i];
+      for (size_t j = bb->code.size(); j > 1; --j) {
+        fuse(bb->code[j - 2], bb->code[j - 1]);
+      }
+    }
+
+    // FOR_ITER/FOR_RANGE fall through into the loop body.
+    for (size_t i = 0; i + 1 < fn->bbs.size(); ++i) {
+      BasicBlock* bb = fn->bbs[i];
+      if (bb->code.empty()) {
+        continue;
+      }
+      CompilerOp* last = bb->code.back();
+      if ((last->code == FOR_ITER || last->code == FOR_RANGE) && targets_.find(last) == targets_.end()) {
+        fuse(last, first_op(fn->bbs[i + 1]));
+      }
+    }
+  }
+};
+
 void optimize(CompilerState* fn) {
   MarkEntries()(fn);
   FuseBasicBlocks()(fn);
@@ -718,10 +1152,16 @@ void optimize(CompilerState* fn) {
 
   if (!getenv("DISABLE_OPT")) {
     if (!getenv("DISABLE_SPECIALIZATION")) LocalTypeSpecialization()(fn);
+    if (!getenv("DISABLE_COMPARE_BRANCH")) CompareAndBranch()(fn);
   }
 
   DeadCodeElim()(fn);
   if (!getenv("DISABLE_OPT")) {
+    if (!getenv("DISABLE_METHOD_CALLS")) MethodCalls()(fn);
+  }
+  if (!getenv("DISABLE_WINDOWS")) ArgumentWindows()(fn);
+  if (!getenv("DISABLE_OPT")) {
+    if (!getenv("DISABLE_TRANSFER")) TransferOwnership()(fn);
     if (!getenv("DISABLE_COMPACT")) CompactRegisters()(fn);
   }
 
@@ -729,5 +1169,9 @@ void optimize(CompilerState* fn) {
   COMPILE_LOG(fn->str().c_str());
 }
 
+void fuse_superinstructions(CompilerState* fn) {
+  if (!getenv("DISABLE_SUPERINSTRUCTIONS")) FuseSuperinstructions()(fn);
+}
+
 
 #endif
@@ -132,6 +132,27 @@ const char* OpUtil::name(int opcode) {
     case DICT_CONTAINS : return "DICT_CONTAINS";
     case DICT_GET : return "DICT_GET";
     case DICT_GET_DEFAULT : return "DICT_GET_DEFAULT";
+
+    case JUMP_ABSOLUTE_FOR_ITER : return "JUMP_ABSOLUTE_FOR_ITER";
+    case LOAD_GLOBAL_CALL_FUNCTION : return "LOAD_GLOBAL_CALL_FUNCTION";
+    case FOR_ITER_MOVE : return "FOR_ITER_MOVE";
+    case MOVE_COMPARE_AND_BRANCH : return "MOVE_COMPARE_AND_BRANCH";
+    case LOAD_ATTR_CALL_FUNCTION : return "LOAD_ATTR_CALL_FUNCTION";
+
+    case COMPARE_AND_BRANCH_FALSE : return "COMPARE_AND_BRANCH_FALSE";
+    case COMPARE_AND_BRANCH_TRUE : return "COMPARE_AND_BRANCH_TRUE";
+
+    case SETUP_RANGE : return "SETUP_RANGE";
+    case FOR_RANGE : return "FOR_RANGE";
+    case JUMP_ABSOLUTE_FOR_RANGE : return "JUMP_ABSOLUTE_FOR_RANGE";
+    case FOR_RANGE_MOVE : return "FOR_RANGE_MOVE";
+
+    case MOVE : return "MOVE";
+    case MOVE_N : return "MOVE_N";
+
+    case LOAD_METHOD : return "LOAD_METHOD";
+    case CALL_METHOD : return "CALL_METHOD";
+    case LOAD_METHOD_CALL_METHOD : return "LOAD_METHOD_CALL_METHOD";
   }
 
   return "BAD_OP";
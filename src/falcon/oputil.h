@@ -17,14 +17,108 @@
 #define DICT_GET 156
 #define DICT_GET_DEFAULT 157
 
+// Superinstructions: the first operation of a frequent pair is rewritten to
+// one of these, and its handler executes the second operation without going
+// back through dispatch.  The pairs were chosen from dynamic opcode-pair
+// counts over the benchmarks/ suite.
+#define JUMP_ABSOLUTE_FOR_ITER 158
+#define LOAD_GLOBAL_CALL_FUNCTION 159
+#define FOR_ITER_MOVE 160
+#define MOVE_COMPARE_AND_BRANCH 161
+#define LOAD_ATTR_CALL_FUNCTION 162
+
+// Compare two registers and branch on the outcome; arg is the comparison.
+#define COMPARE_AND_BRANCH_FALSE 163
+#define COMPARE_AND_BRANCH_TRUE 164
+
+// Counted loops over range/xrange.  SETUP_RANGE replaces the call to
+// range/xrange feeding a for loop, storing the start of the range instead of
+// an iterator; FOR_RANGE steps it up to the stop register.  Both fall back to
+// the iterator protocol if range/xrange has been rebound.
+#define SETUP_RANGE 165
+#define FOR_RANGE 166
+#define JUMP_ABSOLUTE_FOR_RANGE 167
+#define FOR_RANGE_MOVE 168
+
+// Register to register copies.  MOVE copies reg[0] to reg[1]; if arg is 1 the
+// source is dead afterwards, and its reference is transferred to the
+// destination instead of being incref'd.  MOVE_N copies N registers in
+// parallel: the first half of its registers are the sources, the second half
+// the destinations, and bit i of arg marks source i as dead.
+#define MOVE 169
+#define MOVE_N 170
+#define MOVE_N_MAX 16
+
+// Method calls which don't bind the method.  LOAD_METHOD looks up attribute
+// arg of reg[0]: a function found on the type is loaded into reg[1] and the
+// object into reg[2], to be passed as the first argument; anything else is
+// loaded into reg[1] as by LOAD_ATTR, leaving reg[2] empty.  CALL_METHOD is
+// CALL_FUNCTION with that self register following the function.
+#define LOAD_METHOD 171
+#define CALL_METHOD 172
+#define LOAD_METHOD_CALL_METHOD 173
+
 struct OpUtil {
   static const char* name(int opcode);
 
+  // The first half of a superinstruction (or the op itself).
+  static int unfused(int opcode) {
+    switch (opcode) {
+    case JUMP_ABSOLUTE_FOR_ITER: return JUMP_ABSOLUTE;
+    case LOAD_GLOBAL_CALL_FUNCTION: return LOAD_GLOBAL;
+    case FOR_ITER_MOVE: return FOR_ITER;
+    case MOVE_COMPARE_AND_BRANCH: return MOVE;
+    case LOAD_ATTR_CALL_FUNCTION: return LOAD_ATTR;
+    case JUMP_ABSOLUTE_FOR_RANGE: return JUMP_ABSOLUTE;
+    case FOR_RANGE_MOVE: return FOR_RANGE;
+    case LOAD_METHOD_CALL_METHOD: return LOAD_METHOD;
+    default: return opcode;
+    }
+  }
+
+  // Operations with an inline cache (see Hint).
   static bool has_hint(int opcode) {
-    if (opcode == LOAD_ATTR) {
-      return true;
+    static std::set<int> r;
+    if (r.empty()) {
+      r.insert(LOAD_ATTR);
+      r.insert(LOAD_ATTR_CALL_FUNCTION);
+      r.insert(LOAD_METHOD);
+      r.insert(LOAD_METHOD_CALL_METHOD);
+      r.insert(STORE_ATTR);
+      r.insert(LOAD_GLOBAL);
+      r.insert(LOAD_GLOBAL_CALL_FUNCTION);
+      r.insert(CALL_FUNCTION);
+      r.insert(CALL_FUNCTION_KW);
+      r.insert(CALL_FUNCTION_VAR);
+      r.insert(CALL_FUNCTION_VAR_KW);
+      r.insert(CALL_METHOD);
+      r.insert(SETUP_RANGE);
+      r.insert(BINARY_MULTIPLY);
+      r.insert(BINARY_DIVIDE);
+      r.insert(BINARY_ADD);
+      r.insert(BINARY_SUBTRACT);
+      r.insert(BINARY_OR);
+      r.insert(BINARY_XOR);
+      r.insert(BINARY_AND);
+      r.insert(BINARY_RSHIFT);
+      r.insert(BINARY_LSHIFT);
+      r.insert(BINARY_TRUE_DIVIDE);
+      r.insert(BINARY_FLOOR_DIVIDE);
+      r.insert(INPLACE_MULTIPLY);
+      r.insert(INPLACE_DIVIDE);
+      r.insert(INPLACE_ADD);
+      r.insert(INPLACE_SUBTRACT);
+      r.insert(INPLACE_MODULO);
+      r.insert(INPLACE_OR);
+      r.insert(INPLACE_XOR);
+      r.insert(INPLACE_AND);
+      r.insert(INPLACE_RSHIFT);
+      r.insert(INPLACE_LSHIFT);
+      r.insert(INPLACE_TRUE_DIVIDE);
+      r.insert(INPLACE_FLOOR_DIVIDE);
     }
-    return false;
+
+    return r.find(opcode) != r.end();
   }
 
   static bool is_varargs(int opcode) {
@@ -34,12 +128,16 @@ struct OpUtil {
       r.insert(CALL_FUNCTION_KW);
       r.insert(CALL_FUNCTION_VAR);
       r.insert(CALL_FUNCTION_VAR_KW);
+      r.insert(CALL_METHOD);
       r.insert(BUILD_LIST);
       r.insert(BUILD_TUPLE);
 //      r.insert(BUILD_MAP);
       r.insert(BUILD_SET);
       r.insert(MAKE_FUNCTION);
       r.insert(MAKE_CLOSURE);
+      r.insert(SETUP_RANGE);
+      r.insert(MOVE_N);
+      r.insert(UNPACK_SEQUENCE);
     }
 
     return r.find(opcode) != r.end();
@@ -57,6 +155,13 @@ struct OpUtil {
       r.insert(JUMP_FORWARD);
       r.insert(BREAK_LOOP);
       r.insert(CONTINUE_LOOP);
+      r.insert(JUMP_ABSOLUTE_FOR_ITER);
+      r.insert(FOR_ITER_MOVE);
+      r.insert(COMPARE_AND_BRANCH_FALSE);
+      r.insert(COMPARE_AND_BRANCH_TRUE);
+      r.insert(FOR_RANGE);
+      r.insert(JUMP_ABSOLUTE_FOR_RANGE);
+      r.insert(FOR_RANGE_MOVE);
 
       // Not technically, but we need to patch up offsets they use
       // for catching exceptions.  Sort of a `delayed branch`.
@@ -96,6 +201,17 @@ struct OpUtil {
       r.insert(IMPORT_NAME);
       r.insert(IMPORT_FROM);
       r.insert(CONTINUE_LOOP);
+      r.insert(LOAD_GLOBAL_CALL_FUNCTION);
+      r.insert(LOAD_ATTR_CALL_FUNCTION);
+      r.insert(COMPARE_AND_BRANCH_FALSE);
+      r.insert(COMPARE_AND_BRANCH_TRUE);
+      r.insert(SETUP_RANGE);
+      r.insert(MOVE);
+      r.insert(MOVE_N);
+      r.insert(MOVE_COMPARE_AND_BRANCH);
+      r.insert(LOAD_METHOD);
+      r.insert(CALL_METHOD);
+      r.insert(LOAD_METHOD_CALL_METHOD);
     }
 
     return r.find(opcode) != r.end();
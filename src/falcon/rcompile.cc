@@ -43,8 +43,10 @@ struct RCompilerUtil {
         return sizeof(BranchOp<0> );
       } else if (n_regs == 1) {
         return sizeof(BranchOp<1> );
-      } else {
+      } else if (n_regs == 2) {
         return sizeof(BranchOp<2> );
+      } else {
+        return sizeof(BranchOp<3> );
       }
     } else if (op->regs.size() == 0) {
       return sizeof(RegOp<0> );
@@ -61,11 +63,28 @@ struct RCompilerUtil {
     return -1;
   }
 
+  // Point a branch at the instruction at `offset`.  `out` must not be
+  // resized afterwards when DIRECT_THREADING stores absolute addresses.
+  static void patch_label(OpHeader* dst, const std::string& out, int offset) {
+    BranchOp<0>* op = (BranchOp<0>*) dst;
+#if DIRECT_THREADING
+    op->label = out.data() + offset;
+#else
+    op->label = offset;
+    Reg_AssertEq(op->label, offset);
+#endif
+  }
+
   // Lower an operation from compilerop to instruction stream form.
   static void lower_op(char* dst, CompilerOp* src) {
     OpHeader* header = (OpHeader*) dst;
     header->code = src->code;
     header->arg = src->arg;
+#if DIRECT_THREADING
+    Reg_Assert(op_handlers != NULL && src->code < num_op_handlers,
+               "No handler for op %s", OpUtil::name(src->code));
+    header->handler = op_handlers[src->code];
+#endif
 
     if (OpUtil::is_varargs(src->code)) {
       VarRegOp* op = (VarRegOp*) dst;
@@ -77,10 +96,19 @@ struct RCompilerUtil {
         Reg_AssertEq(op->reg[i], src->regs[i]);
       }
       Reg_AssertEq(op->num_registers, src->regs.size());
+#if GETATTR_HINTS
+      op->hint_pos = kInvalidHint;
+#endif
     } else if (OpUtil::is_branch(src->code)) {
       int n_regs = src->regs.size();
-      Reg_AssertLe(n_regs, 2);
-      if (n_regs == 2) {
+      Reg_AssertLe(n_regs, 3);
+      if (n_regs == 3) {
+        BranchOp<3>* op = (BranchOp<3>*) dst;
+        op->reg[0] = src->regs[0];
+        op->reg[1] = src->regs[1];
+        op->reg[2] = src->regs[2];
+        op->label = 0;
+      } else if (n_regs == 2) {
         BranchOp<2>* op = (BranchOp<2>*) dst;
         op->reg[0] = src->regs[0];
         op->reg[1] = src->regs[1];
@@ -128,27 +156,99 @@ struct RCompilerUtil {
  * int r3 = add r1, r2 ('pop' r1, r2)
  */
 
+static void find_jump_targets(CompilerState* state) {
+  unsigned char* codestr = state->py_codestr;
+  for (int offset = 0; offset < state->py_codelen; offset += CODESIZE(codestr[offset])) {
+    int opcode = codestr[offset];
+    switch (opcode) {
+    case JUMP_FORWARD:
+    case FOR_ITER:
+    case SETUP_LOOP:
+    case SETUP_EXCEPT:
+    case SETUP_FINALLY:
+    case SETUP_WITH:
+      state->jump_targets.insert(offset + CODESIZE(opcode) + GETARG(codestr, offset));
+      break;
+    case JUMP_IF_FALSE_OR_POP:
+    case JUMP_IF_TRUE_OR_POP:
+    case JUMP_ABSOLUTE:
+    case POP_JUMP_IF_FALSE:
+    case POP_JUMP_IF_TRUE:
+    case CONTINUE_LOOP:
+      state->jump_targets.insert(GETARG(codestr, offset));
+      break;
+    }
+  }
+}
+
+// Copy src[i] to dst[i] for each i, as if all of the copies happened at
+// once.
+static void add_moves(CompilerState* state, BasicBlock* bb, const std::vector<int>& src, const std::vector<int>& dst) {
+  size_t n = src.size();
+  if (n == 1) {
+    bb->add_dest_op(MOVE, 0, src[0], dst[0]);
+    return;
+  }
+
+  if (n > MOVE_N_MAX) {
+    // Too many for one MOVE_N; go through fresh registers, which can't
+    // overlap either side, so the copies can be split up.
+    std::vector<int> tmp;
+    for (size_t i = 0; i < n; ++i) {
+      tmp.push_back(state->num_reg++);
+    }
+    for (size_t i = 0; i < n; i += MOVE_N_MAX) {
+      size_t end = std::min(n, i + MOVE_N_MAX);
+      add_moves(state, bb, std::vector<int>(src.begin() + i, src.begin() + end),
+                std::vector<int>(tmp.begin() + i, tmp.begin() + end));
+    }
+    for (size_t i = 0; i < n; i += MOVE_N_MAX) {
+      size_t end = std::min(n, i + MOVE_N_MAX);
+      add_moves(state, bb, std::vector<int>(tmp.begin() + i, tmp.begin() + end),
+                std::vector<int>(dst.begin() + i, dst.begin() + end));
+    }
+    return;
+  }
+
+  CompilerOp* op = bb->add_varargs_op(MOVE_N, 0, 2 * n);
+  op->has_dest = false;
+  for (size_t i = 0; i < n; ++i) {
+    op->regs[i] = src[i];
+    op->regs[n + i] = dst[i];
+  }
+}
+
+// True for the registers holding constants and local variables, as opposed
+// to temporaries for values on the stack.
+static bool is_variable(CompilerState* state, int reg) {
+  return reg < state->num_consts + state->num_locals;
+}
+
+static bool on_stack(RegisterStack* stack, int reg) {
+  return std::find(stack->regs.begin(), stack->regs.end(), reg) != stack->regs.end();
+}
+
 // when revisiting a basic block, make sure we have the same registers
 // on the stack as whoever passed through here before.
 //
-// If necessary, create a jump prelude which copies the new registers
+// If necessary, create a jump prelude which moves the new registers
 // to the those created previously.
 BasicBlock* jump_prelude(CompilerState* state, RegisterStack *stack, int offset, BasicBlock* old) {
   BasicBlock* prelude = state->alloc_bb(-offset, stack);
   Reg_AssertEq(stack->regs.size(), old->entry_stack->regs.size());
 
-  int n_moves = 0;
+  std::vector<int> src, dst;
   for (size_t i = 0; i < stack->regs.size(); ++i) {
     int old_reg = old->entry_stack->regs[i];
     int curr_reg = stack->regs[i];
     if (old_reg != curr_reg) {
-      // todo: if we ever change the interpreter to have a MOVE instruction
-      // use that here
-      prelude->add_dest_op(STORE_FAST, 0, curr_reg, old_reg);
-      n_moves++;
+      Reg_Assert(!is_variable(state, old_reg), "Jump prelude would overwrite variable r%d", old_reg);
+      src.push_back(curr_reg);
+      dst.push_back(old_reg);
     }
   }
-  if (n_moves > 0) {
+  if (!src.empty()) {
+    add_moves(state, prelude, src, dst);
     //offset will get patched up later since we're adding 'old' to exits
     prelude->add_op(JUMP_ABSOLUTE, 0);
     prelude->exits.push_back(old);
@@ -157,8 +257,8 @@ BasicBlock* jump_prelude(CompilerState* state, RegisterStack *stack, int offset,
     state->remove_bb(prelude);
     return old;
   }
-
 }
+
 BasicBlock* Compiler::registerize(CompilerState* state, RegisterStack *stack, int offset) {
   Py_ssize_t r;
   int oparg = 0;
@@ -200,6 +300,31 @@ BasicBlock* Compiler::registerize(CompilerState* state, RegisterStack *stack, in
       return entry_point;
     }
 
+    // Other paths into a jump target move their stack into the registers
+    // it starts with, so those can't be variables: copy them aside first.
+    if (state->jump_targets.count(offset)) {
+      std::vector<int> src, dst;
+      for (size_t i = 0; i < stack->regs.size(); ++i) {
+        int r = stack->regs[i];
+        if (is_variable(state, r)) {
+          src.push_back(r);
+          dst.push_back(state->num_reg++);
+          stack->regs[i] = dst.back();
+        }
+      }
+      if (!src.empty()) {
+        BasicBlock* copies = state->alloc_bb(-offset, stack);
+        add_moves(state, copies, src, dst);
+        if (!entry_point) {
+          entry_point = copies;
+        }
+        if (last) {
+          last->exits.push_back(copies);
+        }
+        last = copies;
+      }
+    }
+
     BasicBlock *bb = state->alloc_bb(offset, stack);
     if (!entry_point) {
       entry_point = bb;
@@ -266,7 +391,7 @@ BasicBlock* Compiler::registerize(CompilerState* state, RegisterStack *stack, in
     }
       // Load operations: push one register onto the stack.
     case LOAD_CONST: {
-      stack->push_register(oparg);
+      stack->push_register(state->const_reg(oparg));
       /*int r1 = oparg;
        int r2 = stack->push_register(state->num_reg++);
        bb->add_dest_op(LOAD_FAST, 0, r1, r2);
@@ -274,7 +399,7 @@ BasicBlock* Compiler::registerize(CompilerState* state, RegisterStack *stack, in
       break;
     }
     case LOAD_FAST: {
-      int r1 = state->num_consts + oparg;
+      int r1 = state->local_reg(oparg);
       stack->push_register(r1);
       /*
        int r2 = stack->push_register(state->num_reg++);
@@ -282,9 +407,17 @@ BasicBlock* Compiler::registerize(CompilerState* state, RegisterStack *stack, in
        */
       break;
     }
+    case LOAD_GLOBAL: {
+      int r1 = stack->push_register(state->num_reg++);
+      bb->add_dest_op(opcode, oparg, r1);
+      const char* name = PyString_AsString(PyTuple_GET_ITEM(state->names, oparg));
+      if (strcmp(name, "range") == 0 || strcmp(name, "xrange") == 0) {
+        state->range_fns.insert(r1);
+      }
+      break;
+    }
     case LOAD_CLOSURE:
     case LOAD_DEREF:
-    case LOAD_GLOBAL:
     case LOAD_LOCALS:
     case LOAD_NAME: {
       int r1 = stack->push_register(state->num_reg++);
@@ -299,8 +432,17 @@ BasicBlock* Compiler::registerize(CompilerState* state, RegisterStack *stack, in
     }
     case STORE_FAST: {
       int r1 = stack->pop_register();
-      // Decrement the old value.
-      bb->add_dest_op(opcode, 0, r1, state->num_consts + oparg);
+      int r2 = state->local_reg(oparg);
+      if (r1 == r2) {
+        break;
+      }
+      // Values still on the stack keep the old value of the variable.
+      if (on_stack(stack, r2)) {
+        int saved = state->num_reg++;
+        bb->add_dest_op(MOVE, 0, r2, saved);
+        std::replace(stack->regs.begin(), stack->regs.end(), r2, saved);
+      }
+      bb->add_dest_op(MOVE, 0, r1, r2);
       break;
     }
     // Store operations remove one or more registers from the stack.
@@ -341,6 +483,21 @@ BasicBlock* Compiler::registerize(CompilerState* state, RegisterStack *stack, in
     case GET_ITER: {
       int r1 = stack->pop_register();
       int r2 = stack->push_register(state->num_reg++);
+
+      // range(...)/xrange(...) consumed directly by a for loop: replace the
+      // call with SETUP_RANGE, which leaves the start of the range in r2, and
+      // copy the stop value aside so the loop body can't change it.
+      auto call = state->range_calls.find(r1);
+      if (call != state->range_calls.end() && codestr[offset + CODESIZE(opcode)] == FOR_ITER) {
+        CompilerOp* f = call->second;
+        int stop = state->num_reg++;
+        f->code = SETUP_RANGE;
+        f->regs.back() = r2;
+        bb->add_dest_op(MOVE, 0, f->regs[f->regs.size() - 2], stop);
+        state->range_stops[r2] = stop;
+        break;
+      }
+
       bb->add_dest_op(opcode, oparg, r1, r2);
       break;
     }
@@ -449,6 +606,10 @@ BasicBlock* Compiler::registerize(CompilerState* state, RegisterStack *stack, in
       stack->fill_register_array(f->regs, n + 1);
       f->regs[n + 1] = stack->push_register(state->num_reg++);
       Reg_AssertEq(f->arg, oparg);
+
+      if (nk == 0 && (na == 1 || na == 2) && state->range_fns.count(f->regs[0])) {
+        state->range_calls[f->regs[n + 1]] = f;
+      }
       break;
     }
 
@@ -462,7 +623,7 @@ BasicBlock* Compiler::registerize(CompilerState* state, RegisterStack *stack, in
       CompilerOp* f = bb->add_varargs_op(opcode, oparg, n + 3);
       // pop off the varargs tuple, the actual args, and the function
       stack->fill_register_array(f->regs, n + 2);
-      f->regs[n + 1] = stack->push_register(state->num_reg++);
+      f->regs[n + 2] = stack->push_register(state->num_reg++);
       Reg_AssertEq(f->arg, oparg);
       break;
     }
@@ -597,10 +758,13 @@ BasicBlock* Compiler::registerize(CompilerState* state, RegisterStack *stack, in
       break;
     }
     case UNPACK_SEQUENCE: {
+      // regs[i + 1] receives item i; item 0 ends up on top of the stack.
       int seq = stack->pop_register();
+      CompilerOp* op = bb->add_varargs_op(opcode, 0, oparg + 1);
+      op->has_dest = false;
+      op->regs[0] = seq;
       for (r = oparg; r >= 1; --r) {
-        int elt = stack->push_register(state->num_reg++);
-        bb->add_dest_op(CONST_INDEX, r - 1, seq, elt);
+        op->regs[r] = stack->push_register(state->num_reg++);
       }
       break;
     }
@@ -671,9 +835,22 @@ BasicBlock* Compiler::registerize(CompilerState* state, RegisterStack *stack, in
       RegisterStack a(*stack);
       RegisterStack b(*stack);
       a.push_register(r1);
-      int r2 = a.push_register(state->num_reg++);
 
-      bb->add_dest_op(opcode, 0, r1, r2);
+      auto range = state->range_stops.find(r1);
+      if (range != state->range_stops.end()) {
+        // Counted loops write straight into the loop variable; with no
+        // temporary sharing the value, FOR_RANGE can recycle it.
+        int next = offset + CODESIZE(opcode);
+        int r2 = state->num_reg++;
+        if (codestr[next] == STORE_FAST && !on_stack(stack, state->local_reg(GETARG(codestr, next)))) {
+          r2 = state->local_reg(GETARG(codestr, next));
+        }
+        a.push_register(r2);
+        bb->add_dest_op(FOR_RANGE, 0, r1, range->second, r2);
+      } else {
+        int r2 = a.push_register(state->num_reg++);
+        bb->add_dest_op(opcode, 0, r1, r2);
+      }
 
       // fall-through if iterator had an item, jump forward if iterator is empty.
       BasicBlock* left = registerize(state, &a, offset + CODESIZE(opcode));
@@ -689,8 +866,9 @@ BasicBlock* Compiler::registerize(CompilerState* state, RegisterStack *stack, in
       RegisterStack b(*stack);
       bb->add_op(opcode, oparg, r1);
 
-      BasicBlock* right = registerize(state, &a, oparg);
+      // The fall-through block has to be laid out first.
       BasicBlock* left = registerize(state, &b, offset + CODESIZE(opcode));
+      BasicBlock* right = registerize(state, &a, oparg);
       bb->exits.push_back(left);
       bb->exits.push_back(right);
       return entry_point;
@@ -775,7 +953,7 @@ BasicBlock* Compiler::registerize(CompilerState* state, RegisterStack *stack, in
   return entry_point;
 }
 
-void lower_register_code(CompilerState* state, std::string *out) {
+void lower_register_code(CompilerState* state, std::string *out, std::vector<int>* offsets, std::vector<Hint>* hints) {
 
 // first, dump all of the operations to the output buffer and record
 // their positions.
@@ -788,8 +966,19 @@ void lower_register_code(CompilerState* state, std::string *out) {
       assert(!c->dead);
 
       size_t offset = out->size();
+      offsets->push_back(offset);
       out->resize(out->size() + RCompilerUtil::op_size(c));
       RCompilerUtil::lower_op(&(*out)[0] + offset, c);
+#if GETATTR_HINTS
+      if (OpUtil::has_hint(c->code)) {
+        // VarRegOp's hint_pos lines up with RegOp's.
+        Reg_AssertLt(hints->size(), (size_t) kInvalidHint);
+        ((RegOp<0>*) (&(*out)[0] + offset))->hint_pos = hints->size();
+        Hint hint;
+        bzero(&hint, sizeof(hint));
+        hints->push_back(hint);
+      }
+#endif
       Log_Debug("Wrote op at offset %d, size: %d, %s", offset, RCompilerUtil::op_size(c), c->str().c_str());
     }
   }
@@ -830,9 +1019,8 @@ void lower_register_code(CompilerState* state, std::string *out) {
     if (OpUtil::is_branch(op->code) && op->code != RETURN_VALUE) {
       if (bb->exits.size() == 1) {
         BasicBlock& jmp = *bb->exits[0];
-        ((BranchOp<0>*) op)->label = jmp.reg_offset;
         Reg_AssertGt(jmp.reg_offset, 0);
-        Reg_AssertEq(((BranchOp<0>*)op)->label, jmp.reg_offset);
+        RCompilerUtil::patch_label(op, *out, jmp.reg_offset);
       } else {
         // One exit is the fall-through to the next block.
         BasicBlock& a = *bb->exits[0];
@@ -843,8 +1031,7 @@ void lower_register_code(CompilerState* state, std::string *out) {
         BasicBlock& jmp = (a.idx == fallthrough.idx) ? b : a;
 //        Log_Info("%d, %d", a.idx, b.idx);
         Reg_AssertGt(jmp.reg_offset, 0);
-        ((BranchOp<0>*) op)->label = jmp.reg_offset;
-        Reg_AssertEq(((BranchOp<0>*)op)->label, jmp.reg_offset);
+        RCompilerUtil::patch_label(op, *out, jmp.reg_offset);
       }
     }
   }
@@ -852,6 +1039,21 @@ void lower_register_code(CompilerState* state, std::string *out) {
 
 #include "optimizations.h"
 
+Compiler::~Compiler() {
+  for (CodeCache::iterator i = cache_.begin(); i != cache_.end(); ++i) {
+    delete i->second;
+  }
+}
+
+void Compiler::set_profiling(bool on) {
+  profiling_ = on;
+  for (CodeCache::iterator i = cache_.begin(); i != cache_.end(); ++i) {
+    if (i->second != NULL) {
+      i->second->set_profiling(on);
+    }
+  }
+}
+
 RegisterCode* Compiler::compile_(PyObject* func) {
   PyCodeObject* code = NULL;
   if (PyFunction_Check(func)) {
@@ -871,15 +1073,17 @@ RegisterCode* Compiler::compile_(PyObject* func) {
   CompilerState state(code);
   RegisterStack stack;
 
+  find_jump_targets(&state);
   BasicBlock* entry_point = registerize(&state, &stack, 0);
   if (entry_point == NULL) {
     throw RException(PyExc_SystemError, "Failed to registerize %s", PyEval_GetFuncName(func));
   }
 
   optimize(&state);
+  fuse_superinstructions(&state);
   RegisterCode *regcode = new RegisterCode;
 
-  lower_register_code(&state, &regcode->instructions);
+  lower_register_code(&state, &regcode->instructions, &regcode->offsets, &regcode->hints);
 
   regcode->code_ = (PyObject*) code;
   regcode->version = 1;
@@ -889,12 +1093,16 @@ RegisterCode* Compiler::compile_(PyObject* func) {
     regcode->function = NULL;
   }
   regcode->mapped_registers = 0;
-  regcode->mapped_labels = 0;
+  regcode->mapped_labels = DIRECT_THREADING;
+  regcode->jit = NULL;
   regcode->num_registers = state.num_reg;
+  regcode->window = state.window;
+  regcode->window_size = state.window_size;
 
   regcode->num_freevars = PyTuple_GET_SIZE(code->co_freevars);
   regcode->num_cellvars = PyTuple_GET_SIZE(code->co_cellvars);
   regcode->num_cells = regcode->num_freevars + regcode->num_cellvars;
+  regcode->plan_frame(state.used_consts);
 
   Log_Info(
       "COMPILED %s, %d registers, %d operations, %d stack ops.",
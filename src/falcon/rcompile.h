@@ -22,6 +22,7 @@ struct Compiler {
 private:
   typedef google::dense_hash_map<PyObject*, RegisterCode*> CodeCache;
   CodeCache cache_;
+  bool profiling_;
   BasicBlock* registerize(CompilerState* state, RegisterStack *stack, int offset);
   RegisterCode* compile_(PyObject* function);
 
@@ -35,11 +36,17 @@ private:
   }
 
 public:
-  Compiler() {
+  Compiler() : profiling_(false) {
     cache_.set_empty_key(NULL);
   }
 
+  ~Compiler();
+
   inline RegisterCode* compile(PyObject* function);
+
+  // Switch all code compiled so far, and all code compiled from now on, to
+  // or from profiled dispatch.
+  void set_profiling(bool on);
 };
 
 
@@ -78,6 +85,9 @@ RegisterCode* Compiler::compile(PyObject* func) {
   } catch (const RException& e) {
     Log_Info("Failed to compile function %s", fn_name(func));
   }
+  if (register_code != NULL && profiling_) {
+    register_code->set_profiling(true);
+  }
   cache_[stack_code] = register_code;
   return register_code;
 }
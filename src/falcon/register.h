@@ -77,6 +77,10 @@ struct Register {
     objval = (PyObject*) NULL;
   }
 
+  f_inline bool is_null() const {
+    return objval == NULL;
+  }
+
   f_inline int get_type() const {
     return (i_value & TYPE_MASK);
   }
@@ -119,6 +123,22 @@ struct Register {
       //Log_Info("Register store object %d %d", as_int(), obj->ob_refcnt);
     }
   }
+
+  // Store a borrowed reference: store(PyObject*) takes over the reference it
+  // is given, and releases it for an int.
+  f_inline void store_borrowed(PyObject* obj) {
+    if (obj == NULL || !PyInt_CheckExact(obj)) {
+      objval = obj;
+    } else {
+      store(PyInt_AS_LONG(obj));
+    }
+  }
+
+  static f_inline Register borrowed(PyObject* obj) {
+    Register r;
+    r.store_borrowed(obj);
+    return r;
+  }
 };
 
 #else
@@ -149,6 +169,9 @@ struct Register {
   }
 
   f_inline long as_int() {
+    if (PyInt_CheckExact(v)) {
+      return PyInt_AS_LONG(v);
+    }
     return PyInt_AsLong(v);
   }
 
@@ -163,10 +186,22 @@ struct Register {
   f_inline void reset() {
     v = (PyObject*) NULL;
   }
+
+  f_inline bool is_null() const {
+    return v == NULL;
+  }
   f_inline void store(PyObject* obj) {
     v = obj;
   }
 
+  f_inline void store_borrowed(PyObject* obj) {
+    v = obj;
+  }
+
+  static f_inline Register borrowed(PyObject* obj) {
+    return Register(obj);
+  }
+
   f_inline void store(Register& r) {
     v = r.v;
   }
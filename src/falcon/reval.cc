@@ -6,9 +6,17 @@
 #include <stdint.h>
 #include <stdarg.h>
 
+#include <new>
+
 #include "reval.h"
 #include "rcompile.h"
 
+#if DIRECT_THREADING
+const void* const* op_handlers = NULL;
+int num_op_handlers = 0;
+const void* const* op_profile_handler = NULL;
+#endif
+
 #ifdef FALCON_DEBUG
 static bool logging_enabled() {
   static bool _is_logging = getenv("EVAL_LOG") != NULL;
@@ -63,7 +71,7 @@ struct GilHelper {
 // This let's us access member variables and call API functions easily.
 template<class T>
 struct PyObjHelper {
-  const T& val_;
+  T val_;
   PyObjHelper(const T& t) :
       val_(t) {
   }
@@ -90,53 +98,281 @@ struct PyObjHelper {
   }
 };
 
-RegisterFrame::RegisterFrame(RegisterCode* rcode, PyObject* obj, const ObjVector& args, const ObjVector& kw) :
-    code(rcode) {
+// The function a frame for obj runs, or NULL if obj isn't one (or a method
+// of one).
+static PyObject* called_function(PyObject* obj) {
+  PyObject* function = PyMethod_Check(obj) ? PyMethod_GET_FUNCTION(obj) : obj;
+  return PyFunction_Check(function) ? function : NULL;
+}
+
+// The TypeError CPython raises when code is called with the wrong number of
+// arguments; given counts self and keywords, as CPython's does.
+static RException arg_count_error(RegisterCode* code, int given, bool too_many) {
+  PyCodeObject* co = code->code();
+  const char* name = PyString_AsString(co->co_name);
+  const int defcount = code->num_params - code->first_default;
+  if (co->co_argcount == 0 && !(co->co_flags & (CO_VARARGS | CO_VARKEYWORDS))) {
+    return RException(PyExc_TypeError, "%.200s() takes no arguments (%d given)", name, given);
+  }
+  if (too_many) {
+    return RException(PyExc_TypeError, "%.200s() takes %s %d argument%s (%d given)", name,
+                      defcount ? "at most" : "exactly", co->co_argcount, co->co_argcount == 1 ? "" : "s", given);
+  }
+  const int m = code->first_default;
+  return RException(PyExc_TypeError, "%.200s() takes %s %d argument%s (%d given)", name,
+                    (co->co_flags & CO_VARARGS) || defcount ? "at least" : "exactly", m, m == 1 ? "" : "s", given);
+}
+
+void RegisterFrame::check_args(RegisterCode* code, PyObject* obj, int num_args) {
+  code->check_defaults(called_function(obj));
+  int needed_args = code->num_params;
+  int min_args = code->first_default;
+  int self = 0;
+  if (PyMethod_Check(obj)) {
+    Reg_Assert(PyMethod_GET_SELF(obj) != NULL, "Method call without a bound self.");
+    self = 1;
+    needed_args--;
+    min_args--;
+  }
+
+  if (num_args < min_args) {
+    throw arg_count_error(code, num_args + self, false);
+  }
+
+  if (num_args > needed_args) {
+    throw arg_count_error(code, num_args + self, true);
+  }
+}
+
+RegisterFrame* RegisterFrame::create(RegisterPool* pool, RegisterCode* code, PyObject* obj, const ObjVector& args,
+                                     const ObjVector& kw, const int* kw_slots) {
+  if (!kw.empty() || !code->fixed_args) {
+    return bind(pool, code, obj, args, kw, kw_slots);
+  }
+  const int num_args = args.size();
+  check_args(code, obj, num_args);
+
+  Register* regs = pool->alloc(code->num_registers);
+  int n = 0;
+  if (PyMethod_Check(obj)) {
+    PyObject* self = PyMethod_GET_SELF(obj);
+    Py_INCREF(self);
+    regs[n++].store(self);
+  }
+  for (int i = 0; i < num_args; ++i) {
+    EVAL_LOG("Assigning arguments: %d <- args[%d] %s", n, i, obj_to_str(args[i].as_obj()));
+    regs[n].store(args[i]);
+    regs[n++].incref();
+  }
+  return new (pool->alloc_frame()) RegisterFrame(pool, code, obj, regs, n, 0, regs);
+}
+
+// Every parameter gets exactly one of: a positional argument, a keyword
+// argument, or its default.  Positional arguments past the parameters go to
+// *args, and keywords which don't name a parameter to **kwargs, if the code
+// collects them.
+RegisterFrame* RegisterFrame::bind(RegisterPool* pool, RegisterCode* code, PyObject* obj, const ObjVector& args,
+                                   const ObjVector& kw, const int* kw_slots) {
+  code->check_defaults(called_function(obj));
+  const int num_params = code->num_params;
+  const int flags = code->code()->co_flags;
+  PyObject* varnames = code->varnames();
+
+  int first = 0;
+  if (PyMethod_Check(obj)) {
+    Reg_Assert(PyMethod_GET_SELF(obj) != NULL, "Method call without a bound self.");
+    first = 1;
+  }
+  const int num_args = args.size();
+  const int num_positional = std::min(num_args, num_params - first);
+  if (num_positional < num_args && !(flags & CO_VARARGS)) {
+    throw arg_count_error(code, first + num_args + kw.size() / 2, true);
+  }
+  if (num_params == 0 && !kw.empty() && !(flags & CO_VARKEYWORDS)) {
+    throw arg_count_error(code, kw.size() / 2, true);
+  }
+
+  // Borrow everything until we know the call is good.
+  Register* regs = pool->alloc(code->num_registers);
+  for (int i = 0; i < num_params; ++i) {
+    regs[i].reset();
+  }
+  if (first) {
+    regs[0].store_borrowed(PyMethod_GET_SELF(obj));
+  }
+  for (int i = 0; i < num_positional; ++i) {
+    regs[first + i] = args[i];
+  }
+
+  PyObject* varargs = NULL;
+  PyObject* varkw = (flags & CO_VARKEYWORDS) ? PyDict_New() : NULL;
+  try {
+    for (size_t i = 0; i < kw.size(); i += 2) {
+      PyObject* name = kw[i].as_obj();
+      int slot = kw_slots != NULL ? kw_slots[i / 2] : code->param_slot(name);
+      if (slot < 0) {
+        if (varkw == NULL) {
+          throw RException(PyExc_TypeError, "%.200s() got an unexpected keyword argument '%.400s'",
+                           PyString_AsString(code->code()->co_name), obj_to_str(name));
+        }
+        if (PyDict_GetItem(varkw, name) != NULL) {
+          throw RException(PyExc_TypeError, "%.200s() got multiple values for keyword argument '%.400s'",
+                           PyString_AsString(code->code()->co_name), obj_to_str(name));
+        }
+        if (PyDict_SetItem(varkw, name, kw[i + 1].as_obj()) != 0) {
+          throw RException();
+        }
+        continue;
+      }
+      if (!regs[slot].is_null()) {
+        throw RException(PyExc_TypeError, "%.200s() got multiple values for keyword argument '%.400s'",
+                         PyString_AsString(code->code()->co_name), PyString_AsString(PyTuple_GET_ITEM(varnames, slot)));
+      }
+      regs[slot] = kw[i + 1];
+    }
+    for (int i = 0; i < num_params; ++i) {
+      if (!regs[i].is_null()) {
+        continue;
+      }
+      if (i < code->first_default) {
+        int given = 0;
+        for (int j = 0; j < num_params; ++j) {
+          given += !regs[j].is_null();
+        }
+        throw arg_count_error(code, given, false);
+      }
+      regs[i].store_borrowed(PyTuple_GET_ITEM(code->defaults, i - code->first_default));
+    }
+  } catch (const RException&) {
+    // Nothing bound is ours yet; released registers have to be empty.
+    for (int i = 0; i < num_params; ++i) {
+      regs[i].reset();
+    }
+    Py_XDECREF(varkw);
+    pool->release(regs);
+    throw;
+  }
+
+  if (flags & CO_VARARGS) {
+    varargs = PyTuple_New(num_args - num_positional);
+    for (int i = num_positional; i < num_args; ++i) {
+      PyObject* v = args[i].as_obj();
+      Py_INCREF(v);
+      PyTuple_SET_ITEM(varargs, i - num_positional, v);
+    }
+  }
+
+  for (int i = 0; i < num_params; ++i) {
+    regs[i].incref();
+  }
+  int n = num_params;
+  if (varargs != NULL) {
+    regs[n++].store(varargs);
+  }
+  if (varkw != NULL) {
+    regs[n++].store(varkw);
+  }
+  return new (pool->alloc_frame()) RegisterFrame(pool, code, obj, regs, n, 0, regs);
+}
+
+RegisterFrame* RegisterFrame::create_in_window(RegisterPool* pool, RegisterCode* code, PyObject* obj, Register* args,
+                                               int num_args, Register* caller_end) {
+  check_args(code, obj, num_args);
+
+  // The register before the arguments is set aside for self.
+  Register* regs = args;
+  if (PyMethod_Check(obj)) {
+    PyObject* self = PyMethod_GET_SELF(obj);
+    Py_INCREF(self);
+    --regs;
+    regs->decref();
+    regs->store(self);
+    ++num_args;
+  }
+
+  Register* mark = pool->top();
+  int num_dirty = caller_end - regs;
+  if (!pool->extend(regs, code->num_registers)) {
+    Register* window = regs;
+    regs = mark = pool->alloc(code->num_registers);
+    for (int i = 0; i < num_args; ++i) {
+      regs[i] = window[i];
+      window[i].reset();
+    }
+    num_dirty = 0;
+  }
+  return new (pool->alloc_frame()) RegisterFrame(pool, code, obj, regs, num_args, num_dirty, mark);
+}
+
+void RegisterFrame::destroy(RegisterFrame* frame) {
+  RegisterPool* pool = frame->pool_;
+  Register* mark = frame->pool_mark_;
+  frame->~RegisterFrame();
+  pool->release(mark);
+  pool->release_frame(frame);
+}
+
+RegisterFrame::RegisterFrame(RegisterPool* pool, RegisterCode* rcode, PyObject* obj, Register* regs, int num_args,
+                             int num_dirty, Register* mark) :
+    registers(regs), pool_(pool), code(rcode), pool_mark_(mark), caller(NULL), return_pc(NULL), return_reg(0), instance(NULL) {
   instructions_ = code->instructions.data();
 
-  if (rcode->function) {
-    globals_ = PyFunction_GetGlobals(rcode->function);
+  // Globals and closure come from the function called, which needn't be the
+  // one the code was compiled for.
+  PyObject* function = called_function(obj);
+  if (function) {
+    globals_ = PyFunction_GetGlobals(function);
     locals_ = NULL;
   } else {
     globals_ = PyEval_GetGlobals();
     locals_ = PyEval_GetGlobals();
   }
 
-  Reg_Assert(kw.empty(), "Keyword args not supported.");
-
   builtins_ = PyEval_GetBuiltins();
 
   names_ = code->names();
   consts_ = code->consts();
 
-#if ! STACK_ALLOC_REGISTERS
-  registers = new Register[rcode->num_registers];
-#endif
+  // Everything else is in the code's frame plan (see plan_frame).
+  const int num_registers = code->num_registers;
+  const int num_params = code->num_params;
+  const int num_locals = code->num_locals;
+  const int num_consts = code->num_consts;
 
-  const int num_args = args.size();
+  // Whatever the caller left in its window past the arguments is ours now.
+  for (int i = num_args; i < num_dirty && i < num_registers; ++i) {
+    registers[i].decref();
+  }
+
+  // check_args has made sure the defaults are the ones planned for.
+  int offset = num_args;
+  for (; offset < num_params; ++offset) {
+    PyObject* default_arg = PyTuple_GET_ITEM(code->defaults, offset - code->first_default);
+    EVAL_LOG("Assigning arguments: %d <- defaults[%d] %s", offset, offset - code->first_default, obj_to_str(default_arg));
+    Py_INCREF(default_arg);
+    registers[offset].store(default_arg);
+  }
+
+  for (; offset < num_locals; ++offset) {
+    registers[offset].reset();
+  }
+
+  // The constants are borrowed, so this is just a copy.
+  memcpy(registers + num_locals, code->const_regs.data(), num_consts * sizeof(Register));
+
+  for (register int i = num_locals + num_consts; i < num_registers; ++i) {
+    registers[i].reset();
+  }
+
+  freevars = NULL;
   if (rcode->num_cells > 0) {
-#if ! STACK_ALLOC_REGISTERS
     freevars = new PyObject*[rcode->num_cells];
-#endif
-    int i;
-    for (i = 0; i < rcode->num_cellvars; ++i) {
-      bool found_argname = false;
-      char *cellname = PyString_AS_STRING(PyTuple_GET_ITEM(rcode->code()->co_cellvars, i));
-      for (int arg_idx = 0; arg_idx < num_args; ++arg_idx) {
-        char* argname = PyString_AS_STRING(PyTuple_GET_ITEM(rcode->code()->co_varnames, arg_idx));
-        if (strcmp(cellname, argname) == 0) {
-          PyObject* arg_value = args[arg_idx].as_obj();
-          freevars[i] = PyCell_New(arg_value);
-          found_argname = true;
-          break;
-        }
-      }
-      if (!found_argname) {
-        freevars[i] = PyCell_New(NULL);
-      }
+    for (int i = 0; i < rcode->num_cellvars; ++i) {
+      int param = code->cell_params[i];
+      freevars[i] = PyCell_New(param < 0 ? NULL : registers[param].as_obj());
     }
 
-    PyObject* closure = ((PyFunctionObject*) rcode->function)->func_closure;
+    PyObject* closure = function ? ((PyFunctionObject*) function)->func_closure : NULL;
     if (closure) {
       for (int i = rcode->num_cellvars; i < rcode->num_cells; ++i) {
         freevars[i] = PyTuple_GET_ITEM(closure, i - rcode->num_cellvars) ;
@@ -147,104 +383,128 @@ RegisterFrame::RegisterFrame(RegisterCode* rcode, PyObject* obj, const ObjVector
         freevars[i] = PyCell_New(NULL);
       }
     }
-  } else {
-#if ! STACK_ALLOC_REGISTERS
-            freevars = NULL;
-#endif
-          }
-
-//  Log_Info("Alignments: reg: %d code: %d consts: %d globals: %d, this: %d",
-//           ((long)registers) % 64, ((long)rcode->instructions.data()) % 64, (long)consts_ % 64, (long)globals_ % 64, (long)this % 64);
+  }
+}
 
+RegisterFrame::~RegisterFrame() {
+  // Reset as well: our first registers may be our caller's argument window.
   const int num_registers = code->num_registers;
-
-  // setup const and local register aliases.
-  int num_consts = PyTuple_GET_SIZE(consts());
-  for (int i = 0; i < num_consts; ++i) {
-    PyObject* v = PyTuple_GET_ITEM(consts(), i) ;
-    Py_INCREF(v);
-    registers[i].store(v);
+  const int num_locals = code->num_locals;
+  const int num_consts = code->num_consts;
+  for (register int i = 0; i < num_locals; ++i) {
+    registers[i].decref();
+    registers[i].reset();
+  }
+  for (register int i = num_locals; i < num_locals + num_consts; ++i) {
+    registers[i].reset();
+  }
+  for (register int i = num_locals + num_consts; i < num_registers; ++i) {
+    registers[i].decref();
+    registers[i].reset();
   }
 
-  int needed_args = code->code()->co_argcount;
-  int offset = num_consts;
-  if (PyMethod_Check(obj)) {
-    PyObject* self = PyMethod_GET_SELF(obj);
-
-    Reg_Assert(self != NULL, "Method call without a bound self.");
-    Py_INCREF(self);
-    registers[offset].store(self);
-    ++offset;
-    needed_args--;
+  for (register int i = 0; i < this->code->num_cells; ++i) {
+    Py_XDECREF(freevars[i]);
   }
 
-  if (code->function) {
-    PyObject* def_args = PyFunction_GET_DEFAULTS(code->function);
-    int num_def_args = def_args == NULL ? 0 : PyTuple_GET_SIZE(def_args);
-    int num_args = args.size();
-    if (num_args + num_def_args < needed_args) {
-      throw RException(PyExc_TypeError, "Wrong number of arguments for %s, expected %d, got %d.",
-                       PyEval_GetFuncName(code->function), needed_args - num_def_args, num_args);
-    }
+  delete[] freevars;
+  Py_XDECREF(instance);
+}
 
-    int default_start = needed_args - num_def_args;
-    EVAL_LOG("Calling function with defaults: %s", obj_to_str(def_args));
-    for (int i = 0; i < needed_args; ++i) {
-      if (i < num_args) {
-        EVAL_LOG("Assigning arguments: %d <- args[%d] %s", offset, i, obj_to_str(args[i].as_obj()));
-        registers[offset].store(args[i]);
-      } else {
-        PyObject* default_arg = PyTuple_GET_ITEM(def_args, i - default_start);
-        EVAL_LOG("Assigning arguments: %d <- defaults[%d] %s", offset, i, obj_to_str(default_arg));
-        registers[offset].store(default_arg);
-      }
-      registers[offset].incref();
-      ++offset;
-    }
+RegisterPool::~RegisterPool() {
+  while (free_frames_ != NULL) {
+    void* next = *(void**) free_frames_;
+    free(free_frames_);
+    free_frames_ = next;
   }
 
-  Reg_AssertLt(num_registers, kMaxRegisters);
-  for (register int i = offset; i < num_registers; ++i) {
-    registers[i].reset();
+  if (chunk_ == NULL) {
+    return;
+  }
+  Chunk* c = chunk_;
+  while (c->prev != NULL) {
+    c = c->prev;
   }
+  while (c != NULL) {
+    Chunk* next = c->next;
+    free(c->base);
+    delete c;
+    c = next;
+  }
+}
 
+RegisterPool* RegisterPool::current() {
+  static thread_local RegisterPool pool;
+  return &pool;
 }
 
-RegisterFrame::~RegisterFrame() {
-  const int num_registers = code->num_registers;
-  for (register int i = 0; i < num_registers; ++i) {
-    registers[i].decref();
+void* RegisterPool::new_frame() {
+  void* mem = malloc(sizeof(RegisterFrame));
+  if (mem == NULL) {
+    throw RException(PyExc_MemoryError, "Failed to allocate a frame.");
   }
+  return mem;
+}
 
-  for (register int i = 0; i < this->code->num_cells; ++i) {
-    Py_XDECREF(freevars[i]);
+void RegisterPool::next_chunk(size_t count) {
+  Chunk* next = chunk_ == NULL ? NULL : chunk_->next;
+  if (next != NULL && next->size < count) {
+    // Only empty chunks follow the current one, so we can replace them with
+    // one big enough for this frame.
+    while (next != NULL) {
+      Chunk* after = next->next;
+      free(next->base);
+      delete next;
+      next = after;
+    }
+    chunk_->next = NULL;
   }
 
-#if ! STACK_ALLOC_REGISTERS
-  delete[] registers;
-  delete[] freevars;
-#endif
+  if (next == NULL) {
+    next = new Chunk;
+    next->size = count > kChunkSize ? count : kChunkSize;
+    next->base = (Register*) malloc(sizeof(Register) * next->size);
+    if (next->base == NULL) {
+      delete next;
+      throw RException(PyExc_MemoryError, "Failed to allocate %d registers.", (int) count);
+    }
+    next->prev = chunk_;
+    next->next = NULL;
+    if (chunk_ != NULL) {
+      chunk_->next = next;
+    }
+  }
+
+  next->used = 0;
+  chunk_ = next;
 }
 
-Evaluator::Evaluator() {
-  bzero(op_counts_, sizeof(op_counts_));
-  bzero(op_times_, sizeof(op_times_));
-  total_count_ = 0;
-  last_clock_ = 0;
-  hint_hits_ = 0;
-  hint_misses_ = 0;
+Evaluator::Evaluator() :
+    jit_error(NULL, NULL, NULL) {
+  profiling_ = false;
+  profile_ = NULL;
   compiler = new Compiler;
-  bzero(hints, sizeof(Hint) * kMaxHints);
+  call_hits = 0;
+  call_misses = 0;
+  bzero(arg_tuples, sizeof(arg_tuples));
+
+#if DIRECT_THREADING
+  if (op_handlers == NULL) {
+    eval(NULL);
+  }
+#endif
 
-  // We use a sentinel value for the invalid hint index.
-  hints[kInvalidHint].guard.obj = NULL;
-  hints[kInvalidHint].key = NULL;
-  hints[kInvalidHint].value = NULL;
-  hints[kInvalidHint].version = (unsigned int) -1;
+  if (getenv("FALCON_PROFILE")) {
+    enable_profiling(true);
+  }
 }
 
 Evaluator::~Evaluator() {
+  for (int i = 0; i <= kMaxArgTuple; ++i) {
+    Py_XDECREF(arg_tuples[i]);
+  }
   delete compiler;
+  delete profile_;
 }
 
 void RegisterFrame::fill_locals(PyObject* ldict) {
@@ -252,7 +512,7 @@ void RegisterFrame::fill_locals(PyObject* ldict) {
   for (int i = 0; i < PyTuple_GET_SIZE(varnames) ; ++i) {
     PyObject* name = PyTuple_GET_ITEM(varnames, i) ;
     PyObject* value = PyDict_GetItem(ldict, name);
-    registers[num_consts() + i].store(value);
+    registers[i].store(value);
   }
   Py_INCREF(ldict);
   locals_ = ldict;
@@ -263,10 +523,9 @@ PyObject* RegisterFrame::locals() {
     locals_ = PyDict_New();
   }
   PyObject* varnames = code->varnames();
-  const int num_consts = PyTuple_Size(consts());
   const int num_locals = code->code()->co_nlocals;
   for (int i = 0; i < num_locals; ++i) {
-    PyObject* v = LOAD_OBJ(num_consts + i);
+    PyObject* v = LOAD_OBJ(i);
     if (v != NULL) {
       Py_INCREF(v);
       PyDict_SetItem(locals_, PyTuple_GetItem(varnames, i), v);
@@ -285,11 +544,11 @@ PyObject* Evaluator::eval_frame_to_pyobj(RegisterFrame* frame) {
     EVAL_LOG("Returning to python: %s", obj_to_str(result_obj));
 
     // only delete after incref since deleting the frame decreases reference counts
-    delete frame;
+    RegisterFrame::destroy(frame);
     return result_obj;
 
   } catch (RException& r) {
-    delete frame;
+    RegisterFrame::destroy(frame);
     return NULL;
   }
 }
@@ -322,7 +581,7 @@ RegisterFrame* Evaluator::frame_from_pyframe(PyFrameObject* frame) {
 
   ObjVector v_args;
   ObjVector kw_args;
-  RegisterFrame* f = new RegisterFrame(regcode, (PyObject*) frame->f_code, v_args, kw_args);
+  RegisterFrame* f = RegisterFrame::create(RegisterPool::current(), regcode, (PyObject*) frame->f_code, v_args, kw_args);
   PyFrame_FastToLocals(frame);
   f->fill_locals(frame->f_locals);
   return f;
@@ -341,51 +600,161 @@ RegisterFrame* Evaluator::frame_from_pyfunc(PyObject* obj, PyObject* args, PyObj
   ObjVector v_args;
   v_args.resize(PyTuple_GET_SIZE(args) );
   for (size_t i = 0; i < v_args.size(); ++i) {
-    v_args[i].store(PyTuple_GET_ITEM(args, i) );
+    v_args[i].store_borrowed(PyTuple_GET_ITEM(args, i) );
   }
 
   ObjVector kw_args;
-
-  size_t n_kwds = 0;
   if (kw != NULL && PyDict_Check(kw)) {
-    n_kwds = PyDict_Size(kw);
-  }
-
-  for (size_t i = 0; i < n_kwds; ++i) {
-    throw RException(PyExc_ValueError, "Keywords not yet supported, n_given = %d", n_kwds);
-    // should check whether kw is present in the args
-    // and use default otherwise
-    // kw_args.push_back()
+    Py_ssize_t pos = 0;
+    PyObject* key;
+    PyObject* value;
+    while (PyDict_Next(kw, &pos, &key, &value)) {
+      kw_args.push_back(Register::borrowed(key));
+      kw_args.push_back(Register::borrowed(value));
+    }
   }
-  return new RegisterFrame(regcode, obj, v_args, kw_args);
+  return RegisterFrame::create(RegisterPool::current(), regcode, obj, v_args, kw_args);
 }
 
 RegisterFrame* Evaluator::frame_from_codeobj(PyObject* code) {
   ObjVector args, kw;
   RegisterCode *regcode = compiler->compile(code);
-  return new RegisterFrame(regcode, code, args, kw);
+  return RegisterFrame::create(RegisterPool::current(), regcode, code, args, kw);
+}
+
+void OpProfile::clear() {
+  bzero(counts, sizeof(counts));
+  bzero(cycles, sizeof(cycles));
+  bzero(samples, sizeof(samples));
+  bzero(pairs, sizeof(pairs));
+  last_frame = NULL;
+  last_op = -1;
+  sample_op = -1;
+  sample_start = 0;
 }
 
 void Evaluator::dump_status() {
   Log_Info("Evaluator status:");
-  Log_Info("%d operations executed.", total_count_);
+  if (profile_ == NULL) {
+    return;
+  }
+  for (int i = 0; i < 256; ++i) {
+    if (profile_->counts[i] > 0) {
+      Log_Info("%30s : %12ld, %8.1f cycles", OpUtil::name(i), profile_->counts[i],
+               profile_->samples[i] ? profile_->cycles[i] / (double) profile_->samples[i] : 0.0);
+    }
+  }
+}
+
+void Evaluator::clear_profile() {
+  if (profile_ != NULL) {
+    profile_->clear();
+  }
+}
+
+PyObject* Evaluator::op_profile() {
+  PyObject* counts = PyDict_New();
+  PyObject* cycles = PyDict_New();
+  PyObject* pairs = PyDict_New();
+  PyObject* result = Py_BuildValue("{sNsNsN}", "counts", counts, "cycles", cycles, "pairs", pairs);
+  if (result == NULL) {
+    throw RException();
+  }
+  if (profile_ == NULL) {
+    return result;
+  }
+
   for (int i = 0; i < 256; ++i) {
-    if (op_counts_[i] > 0) {
-      Log_Info("%20s : %10d, %.3f", OpUtil::name(i), op_counts_[i], op_times_[i] / 1e9);
+    if (profile_->counts[i] == 0) {
+      continue;
+    }
+    PyObject* name = PyString_FromString(OpUtil::name(i));
+    PyObject* count = PyLong_FromLongLong(profile_->counts[i]);
+    PyDict_SetItem(counts, name, count);
+    Py_DECREF(count);
+    if (profile_->samples[i] > 0) {
+      PyObject* avg = PyFloat_FromDouble(profile_->cycles[i] / (double) profile_->samples[i]);
+      PyDict_SetItem(cycles, name, avg);
+      Py_DECREF(avg);
+    }
+    Py_DECREF(name);
+
+    for (int j = 0; j < 256; ++j) {
+      if (profile_->pairs[i][j] == 0) {
+        continue;
+      }
+      PyObject* key = Py_BuildValue("(ss)", OpUtil::name(i), OpUtil::name(j));
+      PyObject* count = PyLong_FromLongLong(profile_->pairs[i][j]);
+      PyDict_SetItem(pairs, key, count);
+      Py_DECREF(key);
+      Py_DECREF(count);
+    }
+  }
+  return result;
+}
+
+PyObject* Evaluator::call_stats() {
+  PyObject* result = Py_BuildValue("{sLsL}", "hits", (long long) call_hits, "misses", (long long) call_misses);
+  if (result == NULL) {
+    throw RException();
+  }
+  return result;
+}
+
+PyObject* Evaluator::hint_stats(PyObject* func) {
+  RegisterCode* code = compiler->compile(func);
+  if (code == NULL) {
+    throw RException(PyExc_ValueError, "Can't compile %.200s", obj_to_str(func));
+  }
+  PyObject* result = PyList_New(0);
+  if (result == NULL) {
+    throw RException();
+  }
+#if GETATTR_HINTS
+  for (size_t i = 0; i < code->offsets.size(); ++i) {
+    const RegOp<0>* op = (const RegOp<0>*) (code->instructions.data() + code->offsets[i]);
+    if (!OpUtil::has_hint(op->code)) {
+      continue;
+    }
+    const Hint& hint = code->hints[op->hint_pos];
+    int unfused = OpUtil::unfused(op->code);
+    PyObject* name = Py_None;
+    if (unfused == LOAD_ATTR || unfused == LOAD_METHOD || unfused == STORE_ATTR || unfused == LOAD_GLOBAL) {
+      name = PyTuple_GET_ITEM(code->names(), op->arg);
+    }
+    PyObject* site = Py_BuildValue("{sisssOsLsLsisO}", "index", (int) i, "op", OpUtil::name(op->code), "name", name,
+                                   "hits", (long long) hint.hits, "misses", (long long) hint.misses,
+                                   "entries", hint.num_entries, "megamorphic", hint.megamorphic ? Py_True : Py_False);
+    if (site == NULL || PyList_Append(result, site) < 0) {
+      Py_XDECREF(site);
+      Py_DECREF(result);
+      throw RException();
     }
+    Py_DECREF(site);
   }
+#endif
+  return result;
 }
 
-void Evaluator::collect_info(int opcode) {
-  ++total_count_;
-//  ++op_counts_[opcode];
-//    if (total_count_ % 113 == 0) {
-//    op_times_[opcode] += rdtsc() - last_clock_;
-//    last_clock_ = rdtsc();
-//  }
-  if (total_count_ > 1e9) {
-    dump_status();
-    throw RException(PyExc_SystemError, "Execution entered infinite loop.");
+inline void Evaluator::profile_op(RegisterFrame* frame, const char* pc) {
+  OpProfile* p = profile_;
+  int op = ((OpHeader*) pc)->code;
+
+  if (p->sample_op >= 0) {
+    p->cycles[p->sample_op] += rdtsc() - p->sample_start;
+    p->samples[p->sample_op] += 1;
+    p->sample_op = -1;
+  }
+
+  if (p->last_frame == frame && p->last_op >= 0) {
+    p->pairs[p->last_op][op] += 1;
+  }
+  p->last_frame = frame;
+  p->last_op = op;
+
+  if (p->counts[op]++ % OpProfile::kSampleRate == 0) {
+    p->sample_op = op;
+    p->sample_start = rdtsc();
   }
 }
 
@@ -394,6 +763,16 @@ static f_inline void log_operation(RegisterFrame* frame, const OpType* op, Regis
   EVAL_LOG("%5d %s %s", frame->offset(pc), frame->str().c_str(), op->str(registers).c_str());
 }
 
+// Address of the instruction a branch jumps to.
+template <class OpType>
+static inline f_inline const char* branch_target(RegisterFrame* frame, const OpType& op) {
+#if DIRECT_THREADING
+  return op.label;
+#else
+  return frame->instructions() + op.label;
+#endif
+}
+
 template<class OpType, class SubType>
 struct RegOpImpl {
   static f_inline const char* eval(Evaluator* eval, RegisterFrame* frame, const char* pc, Register* registers) {
@@ -445,6 +824,26 @@ struct IntegerOps {
   _OP(Rshift, >>)
   _OP(Lshift, <<)
 
+  // Evaluate a comparison to 0 or 1; -1 if the comparison isn't handled here.
+  static f_inline int test(long a, long b, int arg) {
+    switch (arg) {
+    case PyCmp_LT:
+      return a < b;
+    case PyCmp_LE:
+      return a <= b;
+    case PyCmp_EQ:
+      return a == b;
+    case PyCmp_NE:
+      return a != b;
+    case PyCmp_GT:
+      return a > b;
+    case PyCmp_GE:
+      return a >= b;
+    default:
+      return -1;
+    }
+  }
+
   static f_inline PyObject* compare(long a, long b, int arg) {
     switch (arg) {
     case PyCmp_LT:
@@ -472,6 +871,26 @@ struct IntegerOps {
 };
 
 struct FloatOps {
+  // Evaluate a comparison to 0 or 1; -1 if the comparison isn't handled here.
+  static f_inline int test(double a, double b, int arg) {
+    switch (arg) {
+    case PyCmp_LT:
+      return a < b;
+    case PyCmp_LE:
+      return a <= b;
+    case PyCmp_EQ:
+      return a == b;
+    case PyCmp_NE:
+      return a != b;
+    case PyCmp_GT:
+      return a > b;
+    case PyCmp_GE:
+      return a >= b;
+    default:
+      return -1;
+    }
+  }
+
   static f_inline PyObject* compare(PyObject* w, PyObject* v, int arg) {
     if (!PyFloat_CheckExact(v) || !PyFloat_CheckExact(w)) {
       return NULL;
@@ -505,6 +924,100 @@ struct FloatOps {
   }
 };
 
+// The builtin types whose slot functions binary operations call directly.
+// Their slots can't change, and with both operands of the same type, the
+// PyNumber_* functions call just the left operand's slot, and fall back on
+// the sequence slots for +.
+static inline f_inline bool has_fixed_slots(PyTypeObject* t) {
+  return t == &PyInt_Type || t == &PyLong_Type || t == &PyFloat_Type || t == &PyComplex_Type ||
+      t == &PyString_Type || t == &PyUnicode_Type || t == &PyList_Type || t == &PyTuple_Type;
+}
+
+// The slot function PyNumber_* would call for opcode on two operands of type
+// t, or NULL.
+static binaryfunc binary_slot(int opcode, PyTypeObject* t) {
+  PyNumberMethods* nb = t->tp_as_number;
+  PySequenceMethods* sq = t->tp_as_sequence;
+  bool inplace = PyType_HasFeature(t, Py_TPFLAGS_HAVE_INPLACEOPS);
+  binaryfunc f = NULL;
+
+#define NUMBER_SLOT(code, slot)\
+  case code: f = nb != NULL ? nb->slot : NULL; break;
+#define INPLACE_SLOT(code, inplace_slot, slot)\
+  case code: f = nb != NULL ? (inplace && nb->inplace_slot != NULL ? nb->inplace_slot : nb->slot) : NULL; break;
+
+  switch (opcode) {
+  NUMBER_SLOT(BINARY_MULTIPLY, nb_multiply)
+  NUMBER_SLOT(BINARY_DIVIDE, nb_divide)
+  NUMBER_SLOT(BINARY_ADD, nb_add)
+  NUMBER_SLOT(BINARY_SUBTRACT, nb_subtract)
+  NUMBER_SLOT(BINARY_OR, nb_or)
+  NUMBER_SLOT(BINARY_XOR, nb_xor)
+  NUMBER_SLOT(BINARY_AND, nb_and)
+  NUMBER_SLOT(BINARY_RSHIFT, nb_rshift)
+  NUMBER_SLOT(BINARY_LSHIFT, nb_lshift)
+  NUMBER_SLOT(BINARY_TRUE_DIVIDE, nb_true_divide)
+  NUMBER_SLOT(BINARY_FLOOR_DIVIDE, nb_floor_divide)
+  INPLACE_SLOT(INPLACE_MULTIPLY, nb_inplace_multiply, nb_multiply)
+  INPLACE_SLOT(INPLACE_DIVIDE, nb_inplace_divide, nb_divide)
+  INPLACE_SLOT(INPLACE_ADD, nb_inplace_add, nb_add)
+  INPLACE_SLOT(INPLACE_SUBTRACT, nb_inplace_subtract, nb_subtract)
+  INPLACE_SLOT(INPLACE_MODULO, nb_inplace_remainder, nb_remainder)
+  INPLACE_SLOT(INPLACE_OR, nb_inplace_or, nb_or)
+  INPLACE_SLOT(INPLACE_XOR, nb_inplace_xor, nb_xor)
+  INPLACE_SLOT(INPLACE_AND, nb_inplace_and, nb_and)
+  INPLACE_SLOT(INPLACE_RSHIFT, nb_inplace_rshift, nb_rshift)
+  INPLACE_SLOT(INPLACE_LSHIFT, nb_inplace_lshift, nb_lshift)
+  INPLACE_SLOT(INPLACE_TRUE_DIVIDE, nb_inplace_true_divide, nb_true_divide)
+  INPLACE_SLOT(INPLACE_FLOOR_DIVIDE, nb_inplace_floor_divide, nb_floor_divide)
+  default:
+    break;
+  }
+
+#undef NUMBER_SLOT
+#undef INPLACE_SLOT
+
+  if (f == NULL && sq != NULL) {
+    if (opcode == INPLACE_ADD) {
+      f = inplace && sq->sq_inplace_concat != NULL ? sq->sq_inplace_concat : sq->sq_concat;
+    } else if (opcode == BINARY_ADD) {
+      f = sq->sq_concat;
+    }
+  }
+  return f;
+}
+
+// ObjF(a, b), for the binary operation at op.  The site's hint keeps, for
+// each pair of operand types it sees, the slot function to call in its place
+// (see has_fixed_slots), or NULL to call ObjF.  Returns NULL on error.
+template<int OpCode, PythonBinaryOp ObjF, class OpType>
+static PyObject* binary_op(RegisterFrame* frame, OpType& op, PyObject* a, PyObject* b) {
+#if GETATTR_HINTS
+  Hint& hint = frame->code->hints[op.hint_pos];
+  PyTypeObject* ta = Py_TYPE(a);
+  PyTypeObject* tb = Py_TYPE(b);
+  HintEntry* e = hint.find(ta, tb);
+  if (e != NULL) {
+    ++hint.hits;
+  } else {
+    ++hint.misses;
+    e = hint.entry_for(ta, tb);
+    if (e != NULL && ta == tb && has_fixed_slots(ta)) {
+      e->data = (void*) binary_slot(OpCode, ta);
+    }
+  }
+  if (e != NULL && e->data != NULL) {
+    PyObject* res = ((binaryfunc) e->data)(a, b);
+    if (res != Py_NotImplemented) {
+      return res;
+    }
+    // Nothing happened: let ObjF report the error.
+    Py_DECREF(res);
+  }
+#endif
+  return ObjF(a, b);
+}
+
 template<int OpCode, PythonBinaryOp ObjF, IntegerBinaryOp IntegerF, bool CanOverFlow>
 struct BinaryOpWithSpecialization: public RegOpImpl<RegOp<3>,
     BinaryOpWithSpecialization<OpCode, ObjF, IntegerF, CanOverFlow> > {
@@ -522,7 +1035,11 @@ struct BinaryOpWithSpecialization: public RegOpImpl<RegOp<3>,
       }
     }
 
-    STORE_REG(op.reg[2], ObjF(r1.as_obj(), r2.as_obj()));
+    PyObject* res = binary_op<OpCode, ObjF>(frame, op, r1.as_obj(), r2.as_obj());
+    if (res == NULL) {
+      throw RException();
+    }
+    STORE_REG(op.reg[2], res);
   }
 };
 
@@ -533,7 +1050,10 @@ struct BinaryOp: public RegOpImpl<RegOp<3>, BinaryOp<OpCode, ObjF> > {
     PyObject* r2 = LOAD_OBJ(op.reg[1]);
     CHECK_VALID(r1);
     CHECK_VALID(r2);
-    PyObject* r3 = ObjF(r1, r2);
+    PyObject* r3 = binary_op<OpCode, ObjF>(frame, op, r1, r2);
+    if (r3 == NULL) {
+      throw RException();
+    }
     STORE_REG(op.reg[2], r3);
   }
 };
@@ -544,6 +1064,9 @@ struct UnaryOp: public RegOpImpl<RegOp<2>, UnaryOp<OpCode, ObjF> > {
     PyObject* r1 = LOAD_OBJ(op.reg[0]);
     CHECK_VALID(r1);
     PyObject* r2 = ObjF(r1);
+    if (r2 == NULL) {
+      throw RException();
+    }
     STORE_REG(op.reg[1], r2);
   }
 };
@@ -885,23 +1408,87 @@ struct LoadLocals: public RegOpImpl<RegOp<1>, LoadLocals> {
   }
 };
 
-struct LoadGlobal: public RegOpImpl<RegOp<1>, LoadGlobal> {
-  static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, RegOp<1>& op, Register* registers) {
-    PyObject* key = PyTuple_GET_ITEM(frame->names(), op.arg) ;
-    PyObject* value = PyDict_GetItem(frame->globals(), key);
-    if (value != NULL) {
-      Py_INCREF(value);
-      STORE_REG(op.reg[0], value);
-      return;
-    }
-    value = PyDict_GetItem(frame->builtins(), key);
-    if (value != NULL) {
-      Py_INCREF(value);
-      STORE_REG(op.reg[0], value);
-      return;
-    }
-    throw RException(PyExc_NameError, "Global name %.200s not defined.", obj_to_str(key));
-  }
+static size_t dict_getoffset(PyDictObject* dict, PyObject* key) {
+  long hash;
+  if (!PyString_CheckExact(key) || (hash = ((PyStringObject *) key)->ob_shash) == -1) {
+    hash = PyObject_Hash(key);
+  }
+
+  PyDictEntry* pos = dict->ma_lookup(dict, key, hash);
+  return pos - dict->ma_table;
+}
+
+#if GETATTR_HINTS
+// The value at the slot of dict a hint remembers for key, or NULL if key is
+// no longer there.  A key is in a dict at most once, so if the slot holds
+// it, that's its value.
+static inline f_inline PyObject* hinted_item(PyDictObject* dict, size_t slot, PyObject* key) {
+  if (slot > (size_t) dict->ma_mask) {
+    return NULL;
+  }
+  const PyDictEntry& e = dict->ma_table[slot];
+  return e.me_key == key ? e.me_value : NULL;
+}
+
+// Whether string key is certainly not in dict: the first slot it could be in
+// is empty, where any lookup for it stops.
+static inline f_inline bool surely_missing(PyDictObject* dict, PyObject* key) {
+  long hash = ((PyStringObject*) key)->ob_shash;
+  return hash != -1 && dict->ma_table[(size_t) hash & dict->ma_mask].me_key == NULL;
+}
+#endif
+
+struct LoadGlobal: public RegOpImpl<RegOp<1>, LoadGlobal> {
+  static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, RegOp<1>& op, Register* registers) {
+    PyObject* key = PyTuple_GET_ITEM(frame->names(), op.arg) ;
+    PyObject* globals = frame->globals();
+#if GETATTR_HINTS
+    // A hint for where we found key last time with these globals: the slot
+    // in the globals, or in the builtins, as long as the globals don't have it.
+    Hint& hint = frame->code->hints[op.hint_pos];
+    const HintEntry* e = hint.find(globals);
+    if (e != NULL &&
+        (e->value == globals || (e->value == frame->builtins() && surely_missing((PyDictObject*) globals, key)))) {
+      PyObject* value = hinted_item((PyDictObject*) e->value, e->slot, key);
+      if (value != NULL) {
+        ++hint.hits;
+        Py_INCREF(value);
+        STORE_REG(op.reg[0], value);
+        return;
+      }
+    }
+    ++hint.misses;
+#endif
+    PyObject* value = PyDict_GetItem(globals, key);
+    if (value != NULL) {
+      remember(frame, op, globals, globals, key);
+      Py_INCREF(value);
+      STORE_REG(op.reg[0], value);
+      return;
+    }
+    value = PyDict_GetItem(frame->builtins(), key);
+    if (value != NULL) {
+      remember(frame, op, globals, frame->builtins(), key);
+      Py_INCREF(value);
+      STORE_REG(op.reg[0], value);
+      return;
+    }
+    throw RException(PyExc_NameError, "global name '%.200s' is not defined", obj_to_str(key));
+  }
+
+  // Hint that key, looked up with these globals, is in dict.
+  static f_inline void remember(RegisterFrame* frame, RegOp<1>& op, PyObject* globals, PyObject* dict, PyObject* key) {
+#if GETATTR_HINTS
+    if (!PyString_CheckExact(key) || !PyDict_CheckExact(globals) || !PyDict_CheckExact(dict)) {
+      return;
+    }
+    HintEntry* e = frame->code->hints[op.hint_pos].entry_for(globals);
+    if (e != NULL) {
+      e->value = dict;
+      e->slot = dict_getoffset((PyDictObject*) dict, key);
+    }
+#endif
+  }
 };
 
 struct StoreGlobal: public RegOpImpl<RegOp<1>, StoreGlobal> {
@@ -930,7 +1517,7 @@ struct LoadName: public RegOpImpl<RegOp<1>, LoadName> {
       r2 = PyDict_GetItem(frame->builtins(), r1);
     }
     if (r2 == NULL) {
-      throw RException(PyExc_NameError, "Name %.200s not defined.", obj_to_str(r1));
+      throw RException(PyExc_NameError, "name '%.200s' is not defined", obj_to_str(r1));
     }
     Py_INCREF(r2);
     STORE_REG(op.reg[0], r2);
@@ -966,16 +1553,41 @@ struct LoadFast: public RegOpImpl<RegOp<2>, LoadFast> {
 };
 typedef LoadFast StoreFast;
 
-struct StoreAttr: public RegOpImpl<RegOp<2>, StoreAttr> {
+struct Move: public RegOpImpl<RegOp<2>, Move> {
   static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, RegOp<2>& op, Register* registers) {
-    PyObject* obj = LOAD_OBJ(op.reg[0]);
-    PyObject* key = PyTuple_GET_ITEM(frame->names(), op.arg);
-    PyObject* value = LOAD_OBJ(op.reg[1]);
-    CHECK_VALID(obj);
-    CHECK_VALID(key);
-    CHECK_VALID(value);
-    if (PyObject_SetAttr(obj, key, value) != 0) {
-      throw RException();
+    Register& a = registers[op.reg[0]];
+    Register& b = registers[op.reg[1]];
+    Register v = a;
+    if (op.arg) {
+      // The source is dead: hand its reference over.
+      a.reset();
+    } else {
+      v.incref();
+    }
+    b.decref();
+    b.store(v);
+  }
+};
+
+// A parallel copy: all of the sources are read before any destination is
+// written, so the sources and destinations may overlap.
+struct MoveN: public VarArgsOpImpl<MoveN> {
+  static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, VarRegOp *op, Register* registers) {
+    int n = op->num_registers / 2;
+    Register values[MOVE_N_MAX];
+    for (int i = 0; i < n; ++i) {
+      Register& src = registers[op->reg[i]];
+      values[i] = src;
+      if (op->arg & (1 << i)) {
+        src.reset();
+      } else {
+        values[i].incref();
+      }
+    }
+    for (int i = 0; i < n; ++i) {
+      Register& dst = registers[op->reg[n + i]];
+      dst.decref();
+      dst.store(values[i]);
     }
   }
 };
@@ -1001,18 +1613,22 @@ struct StoreSubscrList: public RegOpImpl<RegOp<3>, StoreSubscrList> {
     CHECK_VALID(list);
     CHECK_VALID(value);
     Register& idx_reg = registers[op.reg[0]];
-    if (idx_reg.get_type() != IntType) {
-      PyObject* idx_obj = LOAD_OBJ(op.reg[0]);
-      CHECK_VALID(idx_obj);
-      if (PyObject_SetItem(list, idx_obj, value) != 0) {
-        throw RException();
-      }
-    } else {
-      Py_ssize_t idx = idx_reg.as_int();
-      if (PyList_SetItem(list, idx, value) != 0) {
-        throw RException();
+    if (idx_reg.get_type() == IntType) {
+      Py_ssize_t i = idx_reg.as_int();
+      Py_ssize_t n = PyList_GET_SIZE(list);
+      if (i < 0) i += n;
+      if (i >= 0 && i < n) {
+        // The list steals a reference; our register keeps its own.
+        Py_INCREF(value);
+        PyList_SetItem(list, i, value);
+        return;
       }
     }
+    PyObject* idx_obj = LOAD_OBJ(op.reg[0]);
+    CHECK_VALID(idx_obj);
+    if (PyObject_SetItem(list, idx_obj, value) != 0) {
+      throw RException();
+    }
   }
 };
 
@@ -1080,6 +1696,87 @@ struct ConstIndex: public RegOpImpl<RegOp<2>, ConstIndex> {
   }
 };
 
+// Unpack anything other than a tuple or list of the right size, with the
+// same errors as CPython.
+static n_inline void unpack_iterable(VarRegOp *op, Register* registers, PyObject* seq) {
+  int n = op->num_registers - 1;
+  std::vector<PyObject*> items;
+  items.reserve(n);
+
+  PyObject* it = PyObject_GetIter(seq);
+  if (it == NULL) {
+    throw RException();
+  }
+  PyObject* v;
+  while ((int) items.size() < n && (v = PyIter_Next(it)) != NULL) {
+    items.push_back(v);
+  }
+  bool ok = (int) items.size() == n;
+  if (!ok) {
+    if (!PyErr_Occurred()) {
+      PyErr_Format(PyExc_ValueError, "need more than %d value%s to unpack",
+                   (int) items.size(), items.size() == 1 ? "" : "s");
+    }
+  } else if ((v = PyIter_Next(it)) != NULL) {
+    Py_DECREF(v);
+    PyErr_SetString(PyExc_ValueError, "too many values to unpack");
+    ok = false;
+  } else if (PyErr_Occurred()) {
+    ok = false;
+  }
+  Py_DECREF(it);
+
+  if (!ok) {
+    for (size_t i = 0; i < items.size(); ++i) {
+      Py_DECREF(items[i]);
+    }
+    throw RException();
+  }
+
+  for (int i = 0; i < n; ++i) {
+    Register& dst = registers[op->reg[i + 1]];
+    dst.decref();
+    dst.store(items[i]);
+  }
+}
+
+struct UnpackSequence: public VarArgsOpImpl<UnpackSequence> {
+  static const int kMaxItems = 16;
+
+  static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, VarRegOp *op, Register* registers) {
+    PyObject* seq = LOAD_OBJ(op->reg[0]);
+    CHECK_VALID(seq);
+    int n = op->num_registers - 1;
+
+    PyObject** src;
+    if (PyTuple_CheckExact(seq) && PyTuple_GET_SIZE(seq) == n) {
+      src = &PyTuple_GET_ITEM(seq, 0);
+    } else if (PyList_CheckExact(seq) && PyList_GET_SIZE(seq) == n) {
+      src = &PyList_GET_ITEM(seq, 0);
+    } else {
+      src = NULL;
+    }
+
+    if (src == NULL || n > kMaxItems) {
+      unpack_iterable(op, registers, seq);
+      return;
+    }
+
+    // Take our references before storing anything: replacing a destination
+    // may release the sequence.
+    PyObject* items[kMaxItems];
+    for (int i = 0; i < n; ++i) {
+      items[i] = src[i];
+      Py_INCREF(items[i]);
+    }
+    for (int i = 0; i < n; ++i) {
+      Register& dst = registers[op->reg[i + 1]];
+      dst.decref();
+      dst.store(items[i]);
+    }
+  }
+};
+
 static PyDictObject* obj_getdictptr(PyObject* obj, PyTypeObject* type) {
   Py_ssize_t dictoffset;
   PyObject **dictptr;
@@ -1104,116 +1801,282 @@ static PyDictObject* obj_getdictptr(PyObject* obj, PyTypeObject* type) {
   return NULL;
 }
 
-static size_t dict_getoffset(PyDictObject* dict, PyObject* key) {
-  long hash;
-  if (!PyString_CheckExact(key) || (hash = ((PyStringObject *) key)->ob_shash) == -1) {
-    hash = PyObject_Hash(key);
+// The type of C methods looked up on a type (list.append, say), which Python
+// doesn't export.
+static PyTypeObject* method_descr_type() {
+  static PyTypeObject* type = NULL;
+  if (type == NULL) {
+    type = Py_TYPE(PyDict_GetItemString(PyList_Type.tp_dict, "append"));
   }
+  return type;
+}
 
-  PyDictEntry* pos = dict->ma_lookup(dict, key, hash);
-  return pos - dict->ma_table;
+// What a type has for an attribute name, which decides how instances see it.
+enum AttrKind {
+  kNoAttr,
+  // A value, seen as is unless the instance dictionary has the name.
+  kClassValue,
+  // A Python function, bound to the instance unless its dictionary has the name.
+  kMethod,
+  // A descriptor which takes precedence over the instance dictionary.
+  kDataDescr,
+  // A descriptor used unless the instance dictionary has the name.
+  kNonDataDescr
+};
+
+static inline f_inline int attr_kind(PyObject* descr) {
+  if (descr == NULL) {
+    return kNoAttr;
+  }
+  if (PyFunction_Check(descr)) {
+    return kMethod;
+  }
+  if (!PyType_HasFeature(Py_TYPE(descr), Py_TPFLAGS_HAVE_CLASS) || Py_TYPE(descr)->tp_descr_get == NULL) {
+    return kClassValue;
+  }
+  return PyDescr_IsData(descr) ? kDataDescr : kNonDataDescr;
 }
 
-// LOAD_ATTR is common enough to warrant inlining some common code.
-// Most of this is taken from _PyObject_GenericGetAttrWithDict
-static PyObject * obj_getattr(Evaluator* eval, RegOp<2>& op, PyObject *obj, PyObject *name) {
-  PyObjHelper<PyTypeObject*> type(Py_TYPE(obj) );
-  PyObjHelper<PyDictObject*> dict(obj_getdictptr(obj, type));
-  PyObject *descr = NULL;
+// Look up name in type's MRO, as _PyType_Lookup does.  The site's entry for
+// the type keeps the result for as long as the type keeps its version tag,
+// which it loses when it or any base is modified.  Like CPython's method
+// cache, it keeps only the descriptor: its own type can change, so callers
+// find its kind (attr_kind) each time.  Sets looked_up if the entry couldn't
+// be used, and slot to where to keep the instance dictionary slot of the
+// name: in the entry, or for the whole site if the type has none (NULL
+// without hints).
+template<class OpType>
+static PyObject* type_lookup(RegisterFrame* frame, OpType& op, PyTypeObject* type, PyObject* name,
+                             size_t** slot, bool* looked_up) {
 #if GETATTR_HINTS
-  const Hint &op_hint = eval->hints[op.hint_pos];
-
-  // A hint for an instance dictionary lookup.
-  if (dict.val_ && op_hint.guard.dict_size == dict->ma_mask) {
-    const PyDictEntry &e(dict->ma_table[op_hint.version]);
-    if (e.me_key == name) {
-      Py_INCREF(e.me_value);
-      return e.me_value;
-    }
+  Hint& hint = frame->code->hints[op.hint_pos];
+  HintEntry* e = hint.find(type);
+  if (e != NULL && e->tag == type->tp_version_tag && PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG)) {
+    *slot = &e->slot;
+    return e->value;
   }
+  *slot = &hint.slot;
+#else
+  *slot = NULL;
 #endif
-
+  *looked_up = true;
   if (!PyString_Check(name)) {
     throw RException(PyExc_SystemError, "attribute name must be string, not '%.200s'", Py_TYPE(name) ->tp_name);
   }
-
-  if (type->tp_dict == NULL) {
-    if (PyType_Ready(type) < 0) {
-      throw RException();
-    }
+  if (type->tp_dict == NULL && PyType_Ready(type) < 0) {
+    throw RException();
+  }
+  PyObject* descr = _PyType_Lookup(type, name);
+#if GETATTR_HINTS
+  // _PyType_Lookup gives the type a version tag if it can.
+  if (PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG) && (e = hint.entry_for(type)) != NULL) {
+    e->tag = type->tp_version_tag;
+    e->value = descr;
+    *slot = &e->slot;
   }
+#endif
+  return descr;
+}
 
-  // A hint for a type dictionary lookup, we've cached the 'descr' object.
-//  if (op_hint.guard.obj == type && op_hint.key == name && op_hint.version == type->tp_version_tag) {
-//    descr = op_hint.value;
-//  } else {
-  descr = _PyType_Lookup(type, name);
-//  }
+// The value for name in an instance dictionary (borrowed), or NULL.  Sets
+// looked_up if the slot from type_lookup couldn't tell.
+static PyObject* dict_attr(size_t* slot, PyDictObject* dict, PyObject* name, bool* looked_up) {
+  if (dict == NULL) {
+    return NULL;
+  }
+#if GETATTR_HINTS
+  PyObject* res = hinted_item(dict, *slot, name);
+  if (res != NULL || surely_missing(dict, name)) {
+    return res;
+  }
+#endif
+  *looked_up = true;
+  PyObject* value = PyDict_GetItem((PyObject*) dict, name);
+#if GETATTR_HINTS
+  if (value != NULL) {
+    *slot = dict_getoffset(dict, name);
+  }
+#endif
+  return value;
+}
 
-  descrgetfunc getter = NULL;
-  if (descr != NULL && PyType_HasFeature(descr->ob_type, Py_TPFLAGS_HAVE_CLASS)) {
-    getter = descr->ob_type->tp_descr_get;
-    if (getter != NULL && PyDescr_IsData(descr)) {
-      return getter(descr, obj, (PyObject*) type);
-    }
+// The descriptor may remove itself from the type while it runs, and code run
+// since attr_kind (a dictionary key's __eq__, say) may have taken its
+// __get__ away, leaving just the descriptor, as in CPython.
+static inline f_inline PyObject* call_descr(PyObject* descr, PyObject* obj, PyTypeObject* type) {
+  descrgetfunc get = Py_TYPE(descr)->tp_descr_get;
+  Py_INCREF(descr);
+  if (get == NULL) {
+    return descr;
   }
+  PyObject* res = get(descr, obj, (PyObject*) type);
+  Py_DECREF(descr);
+  return res;
+}
 
-  // Look for a match in our object dictionary
-  if (dict != NULL) {
-    PyObject* res = PyDict_GetItem(dict, name);
-    // We found a match.  Create a hint for where to look next time.
-    if (res != NULL) {
+template<class OpType>
+static inline f_inline void count_hint(RegisterFrame* frame, OpType& op, bool looked_up) {
 #if GETATTR_HINTS
-      size_t hint_pos = hint_offset(type, name);
-      size_t dict_pos = dict_getoffset(dict, name);
-
-      Hint h;
-      h.guard.dict_size = dict->ma_mask;
-      h.key = name;
-      h.value = type;
-      h.version = dict_pos;
-      eval->hints[hint_pos] = h;
-      op.hint_pos = hint_pos;
+  Hint& hint = frame->code->hints[op.hint_pos];
+  if (looked_up) {
+    ++hint.misses;
+  } else {
+    ++hint.hits;
+  }
 #endif
-      Py_INCREF(res);
-      return res;
+}
+
+// LOAD_ATTR is common enough to warrant inlining some common code.
+// Most of this is taken from _PyObject_GenericGetAttrWithDict
+template<class OpType>
+static PyObject * obj_getattr(RegisterFrame* frame, OpType& op, PyObject *obj, PyObject *name) {
+  PyTypeObject* type = Py_TYPE(obj);
+  // Classes, old-style instances and anything with __getattr__ do their
+  // own thing.
+  if (type->tp_getattro != PyObject_GenericGetAttr) {
+    PyObject* res = PyObject_GetAttr(obj, name);
+    if (res == NULL) {
+      throw RException();
     }
+    return res;
   }
 
-  // Instance dictionary lookup failed, try to find a match in the class hierarchy.
-  if (getter != NULL) {
-    PyObject* res = getter(descr, obj, (PyObject*) type);
+  bool looked_up = false;
+  size_t* slot;
+  PyObject* descr = type_lookup(frame, op, type, name, &slot, &looked_up);
+  int kind = attr_kind(descr);
+  PyObject* res;
+  if (kind == kDataDescr) {
+    res = call_descr(descr, obj, type);
+  } else {
+    res = dict_attr(slot, obj_getdictptr(obj, type), name, &looked_up);
     if (res != NULL) {
-//      size_t hint_pos = hint_offset(type, name);
-//      Hint h;
-//      h.guard.obj = type;
-//      h.key = name;
-//      h.value = descr;
-//      h.version = type->tp_version_tag;
-//      eval->hints[hint_pos] = h;
-//      op.hint_pos = hint_pos;
-
-      return res;
+      Py_INCREF(res);
+    } else if (kind == kMethod) {
+      res = PyMethod_New(descr, obj, (PyObject*) type);
+    } else if (kind == kNonDataDescr) {
+      res = call_descr(descr, obj, type);
+    } else if (kind == kClassValue) {
+      Py_INCREF(descr);
+      res = descr;
+    } else {
+      throw RException(PyExc_AttributeError, "'%.50s' object has no attribute '%.400s'", type->tp_name,
+                       PyString_AS_STRING(name) );
     }
   }
-
-  if (descr != NULL) {
-    return descr;
+  if (res == NULL) {
+    throw RException();
   }
-
-  throw RException(PyExc_AttributeError, "'%.50s' object has no attribute '%.400s'", type->tp_name,
-                   PyString_AS_STRING(name) );
+  count_hint(frame, op, looked_up);
+  return res;
 }
 
 struct LoadAttr: public RegOpImpl<RegOp<2>, LoadAttr> {
   static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, RegOp<2>& op, Register* registers) {
     PyObject* obj = LOAD_OBJ(op.reg[0]);
     PyObject* name = PyTuple_GET_ITEM(frame->names(), op.arg);
-    PyObject* res = obj_getattr(eval, op, obj, name);
+    PyObject* res = obj_getattr(frame, op, obj, name);
     STORE_REG(op.reg[1], res);
   }
 };
 
+// The function attribute `name` of obj would be a bound method of, if the
+// attribute is looked up the usual way and is a Python function or C method
+// on the type which the instance dictionary doesn't override.  Calling it
+// with obj as the first argument is then the same as calling the attribute.
+template<class OpType>
+static PyObject* unbound_method(RegisterFrame* frame, OpType& op, PyObject* obj, PyObject* name) {
+  PyTypeObject* type = Py_TYPE(obj);
+  if (type->tp_getattro != PyObject_GenericGetAttr) {
+    return NULL;
+  }
+  bool looked_up = false;
+  size_t* slot;
+  PyObject* descr = type_lookup(frame, op, type, name, &slot, &looked_up);
+  int kind = attr_kind(descr);
+  if (kind != kMethod && (kind != kNonDataDescr || Py_TYPE(descr) != method_descr_type())) {
+    return NULL;
+  }
+  if (dict_attr(slot, obj_getdictptr(obj, type), name, &looked_up) != NULL) {
+    return NULL;
+  }
+  count_hint(frame, op, looked_up);
+  return descr;
+}
+
+struct LoadMethod: public RegOpImpl<RegOp<3>, LoadMethod> {
+  static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, RegOp<3>& op, Register* registers) {
+    PyObject* obj = LOAD_OBJ(op.reg[0]);
+    PyObject* name = PyTuple_GET_ITEM(frame->names(), op.arg);
+    PyObject* fn = unbound_method(frame, op, obj, name);
+    if (fn != NULL) {
+      Py_INCREF(fn);
+      Py_INCREF(obj);
+      STORE_REG(op.reg[2], obj);
+    } else {
+      fn = obj_getattr(frame, op, obj, name);
+      Register& self = registers[op.reg[2]];
+      self.decref();
+      self.reset();
+    }
+    STORE_REG(op.reg[1], fn);
+  }
+};
+
+#if GETATTR_HINTS
+// Replace the value of attribute `name` in obj's dictionary, as
+// PyObject_GenericSetAttr would, if the dictionary already has it and no
+// data descriptor on the type is in the way.  Returns false if it can't.
+template<class OpType>
+static bool dict_store(RegisterFrame* frame, OpType& op, PyObject* obj, PyObject* name, PyObject* value) {
+  PyTypeObject* type = Py_TYPE(obj);
+  bool looked_up = false;
+  size_t* slot;
+  PyObject* descr = type_lookup(frame, op, type, name, &slot, &looked_up);
+  if (descr != NULL && PyType_HasFeature(Py_TYPE(descr), Py_TPFLAGS_HAVE_CLASS) && Py_TYPE(descr)->tp_descr_set != NULL) {
+    return false;
+  }
+  PyDictObject* dict = obj_getdictptr(obj, type);
+  if (dict == NULL) {
+    return false;
+  }
+  if (hinted_item(dict, *slot, name) == NULL) {
+    looked_up = true;
+    *slot = dict_getoffset(dict, name);
+    if (hinted_item(dict, *slot, name) == NULL) {
+      return false;
+    }
+  }
+  PyDictEntry& e = dict->ma_table[*slot];
+  PyObject* old = e.me_value;
+  Py_INCREF(value);
+  e.me_value = value;
+  Py_DECREF(old);
+  count_hint(frame, op, looked_up);
+  return true;
+}
+#endif
+
+struct StoreAttr: public RegOpImpl<RegOp<2>, StoreAttr> {
+  static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, RegOp<2>& op, Register* registers) {
+    PyObject* obj = LOAD_OBJ(op.reg[0]);
+    PyObject* key = PyTuple_GET_ITEM(frame->names(), op.arg);
+    PyObject* value = LOAD_OBJ(op.reg[1]);
+    CHECK_VALID(obj);
+    CHECK_VALID(key);
+    CHECK_VALID(value);
+#if GETATTR_HINTS
+    if (Py_TYPE(obj)->tp_setattro == PyObject_GenericSetAttr && dict_store(frame, op, obj, key, value)) {
+      return;
+    }
+    count_hint(frame, op, true);
+#endif
+    if (PyObject_SetAttr(obj, key, value) != 0) {
+      throw RException();
+    }
+  }
+};
+
 struct LoadDeref: public RegOpImpl<RegOp<1>, LoadDeref> {
   static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, RegOp<1>& op, Register* registers) {
     PyObject* closure_cell = frame->freevars[op.arg];
@@ -1273,9 +2136,293 @@ struct MakeClosure: public VarArgsOpImpl<MakeClosure> {
   }
 };
 
-template<bool HasVarArgs, bool HasKwDict>
-struct CallFunction: public VarArgsOpImpl<CallFunction<HasVarArgs, HasKwDict> > {
+// Frames for calls to compiled functions count towards Python's recursion
+// limit, like CPython's own frames; this releases one.
+static inline f_inline void leave_call(RegisterFrame* callee) {
+  RegisterFrame::destroy(callee);
+  Py_LeaveRecursiveCall();
+}
+
+// The compiled code for calling function fn (or a method of it) at `op`,
+// cached in the site's hint so repeated calls skip the compiler's code cache;
+// entry is set to the site's entry for the function, if it has one.  The
+// entry keeps a reference to the function, so no other object can take its
+// place at the same address, and checks its code object, in case func_code
+// is reassigned.
+static RegisterCode* callee_code(Evaluator* eval, RegisterFrame* frame, VarRegOp* op, PyObject* fn,
+                                 HintEntry** entry) {
+  PyObject* function = PyMethod_Check(fn) ? PyMethod_GET_FUNCTION(fn) : fn;
+#if GETATTR_HINTS
+  Hint& hint = frame->code->hints[op->hint_pos];
+  HintEntry* e = hint.find(function);
+  if (e != NULL && e->value == PyFunction_GET_CODE(function)) {
+    ++hint.hits;
+    ++eval->call_hits;
+    *entry = e;
+    return (RegisterCode*) e->data;
+  }
+
+  ++hint.misses;
+  ++eval->call_misses;
+  RegisterCode* code = eval->compiler->compile(function);
+  e = hint.entry_for(function);
+  if (e != NULL) {
+    if (e->owned == NULL) {
+      Py_INCREF(function);
+      e->owned = function;
+    }
+    e->value = PyFunction_GET_CODE(function);
+    e->data = code;
+    e->kind = 0;
+  }
+  *entry = e;
+  return code;
+#else
+  ++eval->call_misses;
+  *entry = NULL;
+  return eval->compiler->compile(function);
+#endif
+}
+
+// What a constructor call returns, once the __init__ run for it has returned
+// value: the new instance, which takes over the call's reference.
+static inline f_inline Register constructed(PyObject* instance, Register value) {
+  if (value.is_obj() && value.as_obj() == Py_None) {
+    Py_DECREF(Py_None);
+    return Register(instance);
+  }
+  RException error(PyExc_TypeError, "__init__() should return None, not '%.200s'",
+                   value.is_obj() ? Py_TYPE(value.as_obj())->tp_name : "int");
+  value.decref();
+  Py_DECREF(instance);
+  throw error;
+}
+
+static PyObject* init_str() {
+  static PyObject* name = NULL;
+  if (name == NULL) {
+    name = PyString_InternFromString("__init__");
+  }
+  return name;
+}
+
+// How calls at `op` construct instances of type: the compiled __init__ to
+// run on a new instance, which is set in init, or NULL to call the type as
+// usual.  Types whose instances come from object.__new__ and are set up by a
+// Python __init__ are constructed the first way.  The site's hint keeps the
+// resolution while the type's version tag is unchanged, which it is until
+// the type or one of its bases has an attribute set; entry is set to the
+// site's entry for the type, if it has one.
+static RegisterCode* constructor(Evaluator* eval, RegisterFrame* frame, VarRegOp* op, PyTypeObject* type,
+                                 PyObject** init, HintEntry** entry) {
+  *entry = NULL;
+#if GETATTR_HINTS
+  Hint& hint = frame->code->hints[op->hint_pos];
+  HintEntry* e = hint.find(type);
+  if (e != NULL && e->tag == type->tp_version_tag && PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG)) {
+    ++hint.hits;
+    *init = e->value;
+    *entry = e;
+    return (RegisterCode*) e->data;
+  }
+  ++hint.misses;
+#endif
+
+  *init = NULL;
+  RegisterCode* code = NULL;
+  if (type->tp_new == PyBaseObject_Type.tp_new && !PyType_HasFeature(type, Py_TPFLAGS_IS_ABSTRACT)) {
+    PyObject* found = _PyType_Lookup(type, init_str());
+    if (found != NULL && PyFunction_Check(found)) {
+      code = eval->compiler->compile(found);
+      *init = found;
+    }
+  }
+#if GETATTR_HINTS
+  // The lookup gave the type a version tag, if there are any left.
+  if (PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG) && (e = hint.entry_for(type)) != NULL) {
+    e->tag = type->tp_version_tag;
+    e->value = *init;
+    e->data = code;
+    e->kind = 0;
+    *entry = e;
+  }
+#endif
+  return code;
+}
+
+// The parameters of `code` which the keywords of call `op` bind to (-1 for
+// those left to **kwargs), copied to slots, or NULL to look them up by name.
+// They're kept in the site's entry e for the callee, while it calls the same
+// code.  The keyword names start at register first_kw.
+static const int* keyword_slots(HintEntry* e, VarRegOp* op, int first_kw, RegisterCode* code,
+                                Register* registers, int* slots) {
+  int nk = (op->arg >> 8) & 0xff;
+  // The entry may have been given to another callee since it was found.
+  if (e == NULL || e->data != code || nk > HintEntry::kMaxKeywords || code->num_params > INT8_MAX) {
+    return NULL;
+  }
+  if (!e->kind) {
+    for (int i = 0; i < nk; ++i) {
+      e->params[i] = code->param_slot(LOAD_OBJ(op->reg[first_kw + 2 * i]));
+    }
+    e->kind = 1;
+  }
+  for (int i = 0; i < nk; ++i) {
+    slots[i] = e->params[i];
+  }
+  return slots;
+}
+
+// The positional arguments of a call with *args, as a new tuple reference.
+static PyObject* star_args(PyObject* fn, PyObject* seq) {
+  if (PyTuple_CheckExact(seq)) {
+    Py_INCREF(seq);
+    return seq;
+  }
+  PyObject* args = PySequence_Tuple(seq);
+  if (args == NULL) {
+    // A TypeError from a generator is the generator's own.
+    if (!PyErr_ExceptionMatches(PyExc_TypeError) || PyGen_Check(seq)) {
+      throw RException();
+    }
+    PyErr_Clear();
+    throw RException(PyExc_TypeError, "%.200s%.200s argument after * must be an iterable, not %.200s",
+                     PyEval_GetFuncName(fn), PyEval_GetFuncDesc(fn), Py_TYPE(seq)->tp_name);
+  }
+  return args;
+}
+
+// The keyword arguments of a call with **kwargs, as a new dict reference.
+static PyObject* star_kwargs(PyObject* fn, PyObject* mapping) {
+  if (PyDict_CheckExact(mapping)) {
+    Py_INCREF(mapping);
+    return mapping;
+  }
+  PyObject* kwargs = PyDict_New();
+  if (PyDict_Update(kwargs, mapping) != 0) {
+    Py_DECREF(kwargs);
+    if (!PyErr_ExceptionMatches(PyExc_AttributeError)) {
+      throw RException();
+    }
+    PyErr_Clear();
+    throw RException(PyExc_TypeError, "%.200s%.200s argument after ** must be a mapping, not %.200s",
+                     PyEval_GetFuncName(fn), PyEval_GetFuncDesc(fn), Py_TYPE(mapping)->tp_name);
+  }
+  return kwargs;
+}
+
+// Call C method `def` of self, as PyCFunction_Call calls a method bound to
+// self, without creating the bound method.
+static PyObject* call_cmethod(PyMethodDef* def, PyObject* self, PyObject* args, PyObject* kw) {
+  PyCFunction meth = def->ml_meth;
+  Py_ssize_t size = PyTuple_GET_SIZE(args);
+  bool no_keywords = kw == NULL || PyDict_Size(kw) == 0;
+  switch (def->ml_flags & ~(METH_CLASS | METH_STATIC | METH_COEXIST)) {
+  case METH_VARARGS:
+    if (no_keywords) {
+      return (*meth)(self, args);
+    }
+    break;
+  case METH_VARARGS | METH_KEYWORDS:
+  case METH_OLDARGS | METH_KEYWORDS:
+    return (*(PyCFunctionWithKeywords) meth)(self, args, kw);
+  case METH_NOARGS:
+    if (no_keywords) {
+      if (size == 0) {
+        return (*meth)(self, NULL);
+      }
+      PyErr_Format(PyExc_TypeError, "%.200s() takes no arguments (%zd given)", def->ml_name, size);
+      return NULL;
+    }
+    break;
+  case METH_O:
+    if (no_keywords) {
+      if (size == 1) {
+        return (*meth)(self, PyTuple_GET_ITEM(args, 0));
+      }
+      PyErr_Format(PyExc_TypeError, "%.200s() takes exactly one argument (%zd given)", def->ml_name, size);
+      return NULL;
+    }
+    break;
+  case METH_OLDARGS:
+    if (no_keywords) {
+      return (*meth)(self, size == 1 ? PyTuple_GET_ITEM(args, 0) : size == 0 ? NULL : args);
+    }
+    break;
+  default:
+    PyErr_BadInternalCall();
+    return NULL;
+  }
+  PyErr_Format(PyExc_TypeError, "%.200s() takes no keyword arguments", def->ml_name);
+  return NULL;
+}
+
+// A tuple for n arguments to a C function: the one kept from an earlier call
+// if there is one, which the caller has to itself until it's released.
+static inline f_inline PyObject* take_arg_tuple(Evaluator* eval, int n) {
+  if (n <= Evaluator::kMaxArgTuple) {
+    PyObject* args = eval->arg_tuples[n];
+    if (args != NULL) {
+      eval->arg_tuples[n] = NULL;
+      return args;
+    }
+  }
+  return PyTuple_New(n);
+}
+
+// Done with a tuple from take_arg_tuple.  Unless the callee kept it, empty it
+// and keep it for the next call.
+static void release_arg_tuple(Evaluator* eval, PyObject* args) {
+  Py_ssize_t n = PyTuple_GET_SIZE(args);
+  if (n == 0 || n > Evaluator::kMaxArgTuple || args->ob_refcnt != 1) {
+    Py_DECREF(args);
+    return;
+  }
+  for (Py_ssize_t i = 0; i < n; ++i) {
+    PyObject* v = PyTuple_GET_ITEM(args, i);
+    PyTuple_SET_ITEM(args, i, NULL);
+    Py_DECREF(v);
+  }
+  // Releasing the arguments may have run a call which kept a tuple already.
+  if (eval->arg_tuples[n] == NULL) {
+    eval->arg_tuples[n] = args;
+  } else {
+    Py_DECREF(args);
+  }
+}
+
+// CALL_FUNCTION and friends.  For CALL_METHOD (IsMethod), the register after
+// the function holds self, unless LOAD_METHOD found an ordinary attribute.
+template<bool HasVarArgs, bool HasKwDict, bool IsMethod = false>
+struct CallFunction: public VarArgsOpImpl<CallFunction<HasVarArgs, HasKwDict, IsMethod> > {
+  // The register holding the first argument.
+  static const int kFirstArg = IsMethod ? 2 : 1;
+
   static f_inline void _eval(Evaluator* eval, RegisterFrame* frame, VarRegOp *op, Register* registers) {
+    RegisterFrame* callee = call(eval, frame, op, registers);
+    if (callee != NULL) {
+      Register result;
+      try {
+        result = eval->eval(callee);
+      } catch (const RException&) {
+        leave_call(callee);
+        throw;
+      }
+      PyObject* instance = callee->instance;
+      callee->instance = NULL;
+      // The callee may overlap our result register.
+      leave_call(callee);
+      if (instance != NULL) {
+        result = constructed(instance, result);
+      }
+      STORE_REG(op->reg[op->num_registers - 1], result);
+    }
+  }
+
+  // Calls to compiled functions aren't run here: we return the frame for the
+  // call, which the dispatch loop pushes (see enter_call).  Anything else is
+  // called right away, its result stored, and we return NULL.
+  static RegisterFrame* call(Evaluator* eval, RegisterFrame* frame, VarRegOp *op, Register* registers) {
     int na = op->arg & 0xff;
     int nk = (op->arg >> 8) & 0xff;
     int n = nk * 2 + na;
@@ -1283,81 +2430,306 @@ struct CallFunction: public VarArgsOpImpl<CallFunction<HasVarArgs, HasKwDict> >
     if (HasVarArgs) n++;
     if (HasKwDict) n++;
 
-    int dst = op->reg[n + 1];
-
     PyObject* fn = LOAD_OBJ(op->reg[0]);
+    PyObject* self = NULL;
+    if (IsMethod && !registers[op->reg[1]].is_null()) {
+      self = LOAD_OBJ(op->reg[1]);
+    }
 
-    Reg_AssertEq(n + 2, op->num_registers);
+    Reg_AssertEq(n + kFirstArg + 1, op->num_registers);
+
+    if (PyMethod_Check(fn) && PyMethod_GET_SELF(fn) == NULL) {
+      // An unbound method is its function, once we know the first argument
+      // is an instance of its class.  CPython complains about anything else.
+      if (self != NULL || na == 0 ||
+          PyObject_IsInstance(LOAD_OBJ(op->reg[kFirstArg]), PyMethod_GET_CLASS(fn)) != 1) {
+        PyErr_Clear();
+        call_python(fn, self, op, registers);
+        return NULL;
+      }
+      fn = PyMethod_GET_FUNCTION(fn);
+    }
 
     RegisterCode* code = NULL;
+    HintEntry* entry = NULL;
+    PyObject* instance = NULL;
 
-    /* TODO:
-     *   Actually accelerate object construction in Falcon by
-     *   first creating the raw/unitialized object and then
-     *   compiling the __init__ method of the called class.
-     *
-     *   To actually get a performance gain from this we would need
-     *   special instance dictionaries which store Falcon registers
-     *   and only lazily construct PyObject representations when asked
-     *   by other Python C API code.
-     */
 //    Log_Info("Calling...");
-    if (!PyCFunction_Check(fn) &&
-        !PyClass_Check(fn) &&
-        !PyType_Check(fn)) {
+    if (PyFunction_Check(fn) || (PyMethod_Check(fn) && PyFunction_Check(PyMethod_GET_FUNCTION(fn)))) {
 //        Log_Info("Compiling...");
-      code = eval->compiler->compile(fn);
+      code = callee_code(eval, frame, op, fn, &entry);
+    } else if (PyType_Check(fn) && Py_TYPE(fn)->tp_call == PyType_Type.tp_call) {
+      // Construct the instance ourselves, as object.__new__ would, and call
+      // its __init__ as a method of it: the frame returns the instance.
+      PyTypeObject* type = (PyTypeObject*) fn;
+      PyObject* init;
+      RegisterCode* init_code = constructor(eval, frame, op, type, &init, &entry);
+      if (init_code != NULL) {
+        instance = type->tp_alloc(type, 0);
+        if (instance == NULL) {
+          throw RException();
+        }
+        fn = init;
+        code = init_code;
+        self = instance;
+      }
+    }
+
+    if (code == NULL) {
+      if (HasVarArgs || HasKwDict || nk > 0 || !call_cfunction(eval, fn, self, op, registers)) {
+        call_python(fn, self, op, registers);
+      }
+      return NULL;
+    }
+
+//  Log_Info("Native call");
+    RegisterFrame* callee;
+    try {
+      callee = bind(eval, frame, code, entry, fn, self, op, registers);
+    } catch (const RException&) {
+      Py_XDECREF(instance);
+      throw;
+    }
+    callee->instance = instance;
+    if (Py_EnterRecursiveCall(" while calling a Python object")) {
+      RegisterFrame::destroy(callee);
+      throw RException();
+    }
+    return callee;
+  }
+
+  // The frame for a call of compiled code, with self (if not NULL) as its
+  // first argument.  entry is the site's hint entry for the callee, or NULL.
+  static RegisterFrame* bind(Evaluator* eval, RegisterFrame* frame, RegisterCode* code, HintEntry* entry,
+                             PyObject* fn, PyObject* self, VarRegOp* op, Register* registers) {
+    int na = op->arg & 0xff;
+    int nk = (op->arg >> 8) & 0xff;
+    RegisterFrame* callee;
+    const RegisterCode* caller = frame->code;
+    if (!HasVarArgs && !HasKwDict && nk == 0 && caller->window >= 0 && na < caller->window_size &&
+        code->fixed_args) {
+      // Arguments computed for the call are already in our window (see
+      // ArgumentWindows); copy in the rest.
+      Register* window = registers + caller->window + 1;
+      for (register int i = 0; i < na; ++i) {
+        Register* arg = registers + op->reg[i + kFirstArg];
+        if (arg != window + i) {
+          Register v = *arg;
+          v.incref();
+          window[i].decref();
+          window[i].store(v);
+        }
+      }
+      if (self != NULL) {
+        // Self is just the first argument, in the register set aside for it.
+        Register* self_reg = window - 1;
+        if (!IsMethod || registers + op->reg[1] != self_reg || self_reg->is_null()) {
+          Py_INCREF(self);
+          self_reg->decref();
+          self_reg->store(self);
+        }
+        callee = RegisterFrame::create_in_window(frame->pool_, code, fn, self_reg, na + 1,
+                                                 registers + caller->num_registers);
+      } else {
+        callee = RegisterFrame::create_in_window(frame->pool_, code, fn, window, na,
+                                                 registers + caller->num_registers);
+      }
+    } else if (!HasVarArgs && !HasKwDict) {
+      ObjVector args, kw;
+      if (self != NULL) {
+        args.push_back(Register::borrowed(self));
+      }
+      for (register int i = 0; i < na; ++i) {
+        args.push_back(registers[op->reg[i + kFirstArg]]);
+      }
+      int slots[HintEntry::kMaxKeywords];
+      const int* kw_slots = NULL;
+      if (nk > 0) {
+        kw_slots = keyword_slots(entry, op, na + kFirstArg, code, registers, slots);
+        kw.resize(nk * 2);
+        for (register int i = 0; i < nk * 2; ++i) {
+          kw[i].store(registers[op->reg[na + kFirstArg + i]]);
+        }
+      }
+      callee = RegisterFrame::create(frame->pool_, code, fn, args, kw, kw_slots);
+    } else {
+      callee = call_unpacked(code, fn, self, op, registers, frame->pool_);
+    }
+    return callee;
+  }
+
+  // Bind a call with *args or **kwargs to compiled code: the sequence and
+  // mapping are unpacked straight into the callee's arguments.
+  static RegisterFrame* call_unpacked(RegisterCode* code, PyObject* fn, PyObject* self, VarRegOp* op,
+                                      Register* registers, RegisterPool* pool) {
+    int na = op->arg & 0xff;
+    int nk = (op->arg >> 8) & 0xff;
+    PyObject* varargs = HasVarArgs ? star_args(fn, LOAD_OBJ(op->reg[na + nk * 2 + 1])) : NULL;
+    PyObject* kwargs = NULL;
+    try {
+      if (HasKwDict) {
+        kwargs = star_kwargs(fn, LOAD_OBJ(op->reg[na + nk * 2 + 1 + HasVarArgs]));
+      }
+
+      ObjVector args, kw;
+      if (self != NULL) {
+        args.push_back(Register::borrowed(self));
+      }
+      for (register int i = 0; i < na; ++i) {
+        args.push_back(registers[op->reg[i + 1]]);
+      }
+      if (varargs != NULL) {
+        for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(varargs); ++i) {
+          args.push_back(Register::borrowed(PyTuple_GET_ITEM(varargs, i)));
+        }
+      }
+      for (register int i = 0; i < nk * 2; ++i) {
+        kw.push_back(registers[op->reg[na + 1 + i]]);
+      }
+      if (kwargs != NULL) {
+        Py_ssize_t pos = 0;
+        PyObject* key;
+        PyObject* value;
+        while (PyDict_Next(kwargs, &pos, &key, &value)) {
+          if (!PyString_Check(key)) {
+            throw RException(PyExc_TypeError, "%s%s keywords must be strings", PyEval_GetFuncName(fn),
+                             PyEval_GetFuncDesc(fn));
+          }
+          kw.push_back(Register::borrowed(key));
+          kw.push_back(Register::borrowed(value));
+        }
+      }
+      RegisterFrame* callee = RegisterFrame::create(pool, code, fn, args, kw);
+      Py_XDECREF(varargs);
+      Py_XDECREF(kwargs);
+      return callee;
+    } catch (const RException&) {
+      Py_XDECREF(varargs);
+      Py_XDECREF(kwargs);
+      throw;
+    }
+  }
+
+  // Call a C function, or C method of self, with positional arguments straight
+  // from our registers, storing the result: METH_NOARGS and METH_O functions
+  // take their argument as is, and METH_VARARGS ones get a reused tuple.
+  // Returns false, having done nothing, for anything else.
+  static bool call_cfunction(Evaluator* eval, PyObject* fn, PyObject* self, VarRegOp* op,
+                                      Register* registers) {
+    PyMethodDef* def;
+    if (self == NULL && PyCFunction_Check(fn)) {
+      def = ((PyCFunctionObject*) fn)->m_ml;
+      self = PyCFunction_GET_SELF(fn);
+    } else if (IsMethod && self != NULL && Py_TYPE(fn) == method_descr_type()) {
+      def = ((PyMethodDescrObject*) fn)->d_method;
+    } else {
+      return false;
     }
 
-    if (code == NULL || nk > 0) {
-//      Log_Info("Going to Python for function %s", PyEval_GetFuncName(fn));
-      PyObject* args = PyTuple_New(na);
-
+    int na = op->arg & 0xff;
+    int flags = def->ml_flags & ~(METH_CLASS | METH_STATIC | METH_COEXIST);
+    PyObject* res;
+    if (flags == METH_NOARGS && na == 0) {
+      res = (*def->ml_meth)(self, NULL);
+    } else if (flags == METH_O && na == 1) {
+      res = (*def->ml_meth)(self, LOAD_OBJ(op->reg[kFirstArg]));
+    } else if (flags == METH_VARARGS || flags == (METH_VARARGS | METH_KEYWORDS)) {
+      PyObject* args = take_arg_tuple(eval, na);
       for (register int i = 0; i < na; ++i) {
-        PyObject* v = LOAD_OBJ(op->reg[i+1]);
+        PyObject* v = LOAD_OBJ(op->reg[i + kFirstArg]);
         Py_INCREF(v);
         PyTuple_SET_ITEM(args, i, v);
       }
-
-      PyObject* kwdict = NULL;
-      if (nk > 0) {
-        kwdict = PyDict_New();
-        for (register int i = na; i < nk * 2; i += 2) {
-          // starting at +1 since the first register was the fn
-          // so keyword args actually start at na+1
-          PyObject* k = LOAD_OBJ(op->reg[i+1]);
-          PyObject* v = LOAD_OBJ(op->reg[i+2]);
-
-          Reg_Assert(PyString_Check(k), "Expected key to be string");
-          char* kstr = PyString_AsString(k);
-          PyDict_SetItemString(kwdict, kstr, v);
-          //PyDict_SetItem(kwdict, k, v);
-            }
-          }
-
-      PyObject* res = NULL;
-      if (PyCFunction_Check(fn)) {
-        res = PyCFunction_Call(fn, args, kwdict);
+      if (flags & METH_KEYWORDS) {
+        res = (*(PyCFunctionWithKeywords) def->ml_meth)(self, args, NULL);
       } else {
-        res = PyObject_Call(fn, args, kwdict);
+        res = (*def->ml_meth)(self, args);
       }
-      Py_DECREF(args);
+      release_arg_tuple(eval, args);
+    } else {
+      // Wrong argument counts are left to complain as usual.
+      return false;
+    }
 
-      if (res == NULL) {
-        throw RException();
+    if (res == NULL) {
+      throw RException();
+    }
+    STORE_REG(op->reg[op->num_registers - 1], res);
+    return true;
+  }
+
+  // Call something we haven't compiled through the C API, storing the result.
+  // self, if given, goes before the arguments.
+  static void call_python(PyObject* fn, PyObject* self, VarRegOp* op, Register* registers) {
+    int na = op->arg & 0xff;
+    int nk = (op->arg >> 8) & 0xff;
+    // C methods are called with self separately.
+    bool cmethod = self != NULL && Py_TYPE(fn) == method_descr_type();
+    int first = self != NULL && !cmethod ? 1 : 0;
+    PyObject* args = PyTuple_New(first + na);
+    if (first) {
+      Py_INCREF(self);
+      PyTuple_SET_ITEM(args, 0, self);
+    }
+    for (register int i = 0; i < na; ++i) {
+      PyObject* v = LOAD_OBJ(op->reg[i + kFirstArg]);
+      Py_INCREF(v);
+      PyTuple_SET_ITEM(args, first + i, v);
+    }
+
+    PyObject* kwdict = NULL;
+    try {
+      if (HasVarArgs) {
+        PyObject* varargs = star_args(fn, LOAD_OBJ(op->reg[na + nk * 2 + 1]));
+        PyObject* all = PySequence_Concat(args, varargs);
+        Py_DECREF(varargs);
+        Py_DECREF(args);
+        args = all;
+        if (args == NULL) {
+          throw RException();
+        }
+      }
+      if (HasKwDict) {
+        PyObject* kwargs = star_kwargs(fn, LOAD_OBJ(op->reg[na + nk * 2 + 1 + HasVarArgs]));
+        kwdict = nk > 0 ? PyDict_Copy(kwargs) : kwargs;
+        if (nk > 0) {
+          Py_DECREF(kwargs);
+        }
+      } else if (nk > 0) {
+        kwdict = PyDict_New();
       }
+      for (register int i = na; i < na + nk * 2; i += 2) {
+        PyObject* k = LOAD_OBJ(op->reg[i + kFirstArg]);
+        PyObject* v = LOAD_OBJ(op->reg[i + kFirstArg + 1]);
+        Reg_Assert(PyString_Check(k), "Expected key to be string");
+        if (HasKwDict && PyDict_GetItem(kwdict, k) != NULL) {
+          throw RException(PyExc_TypeError, "%s%s got multiple values for keyword argument '%s'",
+                           PyEval_GetFuncName(fn), PyEval_GetFuncDesc(fn), PyString_AsString(k));
+        }
+        PyDict_SetItem(kwdict, k, v);
+      }
+    } catch (const RException&) {
+      Py_XDECREF(args);
+      Py_XDECREF(kwdict);
+      throw;
+    }
 
-      STORE_REG(dst, res);
+    PyObject* res = NULL;
+    if (cmethod) {
+      res = call_cmethod(((PyMethodDescrObject*) fn)->d_method, self, args, kwdict);
+    } else if (PyCFunction_Check(fn)) {
+      res = PyCFunction_Call(fn, args, kwdict);
     } else {
-//      Log_Info("Native call");
-      ObjVector args, kw;
-      args.resize(na);
-      for (register int i = 0; i < na; ++i) {
-        args[i].store(registers[op->reg[i + 1]]);
-      }
-      RegisterFrame f(code, fn, args, kw);
-      STORE_REG(dst, eval->eval(&f));
+      res = PyObject_Call(fn, args, kwdict);
+    }
+    Py_DECREF(args);
+    Py_XDECREF(kwdict);
+
+    if (res == NULL) {
+      throw RException();
     }
+
+    STORE_REG(op->reg[op->num_registers - 1], res);
   }
 };
 
@@ -1365,6 +2737,7 @@ typedef CallFunction<false, false> CallFunctionSimple;
 typedef CallFunction<true, false> CallFunctionVar;
 typedef CallFunction<false, true> CallFunctionKw;
 typedef CallFunction<true, true> CallFunctionVarKw;
+typedef CallFunction<false, false, true> CallMethod;
 
 struct GetIter: public RegOpImpl<RegOp<2>, GetIter> {
   static f_inline void _eval(Evaluator *eval, RegisterFrame* frame, RegOp<2>& op, Register* registers) {
@@ -1382,9 +2755,89 @@ struct ForIter: public BranchOpImpl<BranchOp<2>, ForIter> {
       STORE_REG(op.reg[1], iter);
       *pc += sizeof(BranchOp<2> );
     } else {
-      *pc = frame->instructions() + op.label;
+      *pc = branch_target(frame, op);
+    }
+
+  }
+};
+
+// Builtin range function; xrange is PyRange_Type.
+static PyObject* builtin_range() {
+  static PyObject* range = NULL;
+  if (range == NULL) {
+    range = PyDict_GetItemString(PyEval_GetBuiltins(), "range");
+  }
+  return range;
+}
+
+// range(...) or xrange(...) feeding a for loop.  For the builtins with int
+// arguments, we store the start of the range; FOR_RANGE counts from there.
+// Anything else is called as usual and we store its iterator.
+struct SetupRange: public VarArgsOpImpl<SetupRange> {
+  static f_inline void _eval(Evaluator* eval, RegisterFrame* frame, VarRegOp *op, Register* registers) {
+    int na = op->arg;
+    int dst = op->reg[na + 1];
+    PyObject* fn = LOAD_OBJ(op->reg[0]);
+
+    if ((fn == (PyObject*) &PyRange_Type || fn == builtin_range()) &&
+        registers[op->reg[1]].get_type() == IntType &&
+        registers[op->reg[na]].get_type() == IntType) {
+      long start = na == 1 ? 0 : LOAD_INT(op->reg[1]);
+      STORE_REG(dst, start);
+      return;
+    }
+
+    CallFunctionSimple::_eval(eval, frame, op, registers);
+    PyObject* iter = PyObject_GetIter(LOAD_OBJ(dst));
+    if (iter == NULL) {
+      throw RException();
+    }
+    STORE_REG(dst, iter);
+  }
+};
+
+// Registers: counter, stop, destination.  The counter is either an int from
+// SETUP_RANGE or an iterator if the guard there failed.
+struct ForRange: public BranchOpImpl<BranchOp<3>, ForRange> {
+  static f_inline void _eval(Evaluator* eval, RegisterFrame *frame, BranchOp<3>& op, const char **pc,
+                             Register* registers) {
+    Register& counter = registers[op.reg[0]];
+    if (counter.get_type() == IntType) {
+      long i = counter.as_int();
+      if (i < LOAD_INT(op.reg[1])) {
+        // Hand the current value to the loop variable and start a new one.
+        Register& dst = registers[op.reg[2]];
+#if !USE_TYPED_REGISTERS
+        // If nothing else kept the previous value of the loop variable, it
+        // becomes the next counter instead of allocating a new int.
+        PyObject* prev = dst.as_obj();
+        if (prev != NULL && prev->ob_refcnt == 1 && PyInt_CheckExact(prev)) {
+          ((PyIntObject*) prev)->ob_ival = i + 1;
+          dst.store(counter);
+          counter.store(prev);
+          *pc += sizeof(BranchOp<3> );
+          return;
+        }
+#endif
+        dst.decref();
+        dst.store(counter);
+        counter.store(i + 1);
+        *pc += sizeof(BranchOp<3> );
+      } else {
+        *pc = branch_target(frame, op);
+      }
+      return;
     }
 
+    PyObject* item = PyIter_Next(LOAD_OBJ(op.reg[0]));
+    if (item) {
+      STORE_REG(op.reg[2], item);
+      *pc += sizeof(BranchOp<3> );
+    } else if (PyErr_Occurred()) {
+      throw RException();
+    } else {
+      *pc = branch_target(frame, op);
+    }
   }
 };
 
@@ -1394,7 +2847,7 @@ struct JumpIfFalseOrPop: public BranchOpImpl<BranchOp<1>, JumpIfFalseOrPop> {
     PyObject *r1 = LOAD_OBJ(op.reg[0]);
     if (r1 == Py_False || (PyObject_IsTrue(r1) == 0)) {
 //      EVAL_LOG("Jumping: %s -> %d", obj_to_str(r1), op.label);
-        *pc = frame->instructions() + op.label;
+        *pc = branch_target(frame, op);
       } else {
         *pc += sizeof(BranchOp<1>);
       }
@@ -1407,7 +2860,7 @@ struct JumpIfTrueOrPop: public BranchOpImpl<BranchOp<1>, JumpIfTrueOrPop> {
                              Register* registers) {
     PyObject* r1 = LOAD_OBJ(op.reg[0]);
     if (r1 == Py_True || (PyObject_IsTrue(r1) == 1)) {
-      *pc = frame->instructions() + op.label;
+      *pc = branch_target(frame, op);
     } else {
       *pc += sizeof(BranchOp<1>);
     }
@@ -1415,19 +2868,70 @@ struct JumpIfTrueOrPop: public BranchOpImpl<BranchOp<1>, JumpIfTrueOrPop> {
   }
 };
 
+// COMPARE_OP followed by POP_JUMP_IF_FALSE/TRUE, evaluated without storing a
+// bool: ints and exact floats are compared directly, anything else goes
+// through cmp_outcome and a truth test.
+template<bool JumpIfTrue>
+struct CompareAndBranch: public BranchOpImpl<BranchOp<2>, CompareAndBranch<JumpIfTrue> > {
+  static f_inline int test(int arg, Register& r1, Register& r2) {
+    int res = -1;
+    if (r1.get_type() == IntType && r2.get_type() == IntType) {
+      res = IntegerOps::test(r1.as_int(), r2.as_int(), arg);
+    } else {
+      PyObject* v = r1.as_obj();
+      PyObject* w = r2.as_obj();
+      if (PyFloat_CheckExact(v) && PyFloat_CheckExact(w)) {
+        res = FloatOps::test(PyFloat_AS_DOUBLE(v), PyFloat_AS_DOUBLE(w), arg);
+      }
+    }
+
+    if (res != -1) {
+      return res;
+    }
+
+    PyObject* obj = cmp_outcome(arg, r1.as_obj(), r2.as_obj());
+    if (obj == NULL) {
+      throw RException();
+    }
+
+    if (obj == Py_True) {
+      res = 1;
+    } else if (obj == Py_False) {
+      res = 0;
+    } else {
+      res = PyObject_IsTrue(obj);
+    }
+    Py_DECREF(obj);
+
+    if (res == -1) {
+      throw RException();
+    }
+    return res;
+  }
+
+  static f_inline void _eval(Evaluator* eval, RegisterFrame *frame, BranchOp<2>& op, const char **pc,
+                             Register* registers) {
+    if (test(op.arg, registers[op.reg[0]], registers[op.reg[1]]) == JumpIfTrue) {
+      *pc = branch_target(frame, op);
+    } else {
+      *pc += sizeof(BranchOp<2>);
+    }
+  }
+};
+
 struct JumpAbsolute: public BranchOpImpl<BranchOp<0>, JumpAbsolute> {
   static f_inline void _eval(Evaluator* eval, RegisterFrame *frame, BranchOp<0>& op, const char **pc,
                              Register* registers) {
-    EVAL_LOG("Jumping to: %d", op.label);
-    *pc = frame->instructions() + op.label;
+    EVAL_LOG("Jumping to: %d", frame->offset(branch_target(frame, op)));
+    *pc = branch_target(frame, op);
   }
 };
 
 struct BreakLoop: public BranchOpImpl<BranchOp<0>, BreakLoop> {
   static f_inline void _eval(Evaluator* eval, RegisterFrame *frame, BranchOp<0>& op, const char **pc,
                              Register* registers) {
-    EVAL_LOG("Jumping to: %d", op.label);
-    *pc = frame->instructions() + op.label;
+    EVAL_LOG("Jumping to: %d", frame->offset(branch_target(frame, op)));
+    *pc = branch_target(frame, op);
   }
 };
 
@@ -1749,8 +3253,9 @@ struct ImportFrom: public RegOpImpl<RegOp<2>, ImportFrom> {
 struct SetupExcept: public BranchOpImpl<BranchOp<0>, SetupExcept> {
   static f_inline void _eval(Evaluator* eval, RegisterFrame *frame, BranchOp<0>& op, const char **pc,
                              Register* registers) {
-    EVAL_LOG("Pushing handler: %d", op.label);
-    frame->exc_handlers_.push_back(op.label);
+    int handler_offset = branch_target(frame, op) - frame->instructions();
+    EVAL_LOG("Pushing handler: %d", handler_offset);
+    frame->exc_handlers_.push_back(handler_offset);
     *pc += sizeof(BranchOp<0> );
   }
 };
@@ -1781,6 +3286,40 @@ struct RaiseVarArgs: public RegOpImpl<RegOp<3>, RaiseVarArgs> {
   }
 };
 
+// A superinstruction: evaluate First, then evaluate Second without going back
+// through dispatch if control arrived at an instruction with SecondCode.  The
+// second instruction keeps its own encoding, so the check is only needed
+// when First is a branch -- but it's a single, well predicted comparison.
+template<class First, class Second, int SecondCode>
+struct FusedOp {
+  static f_inline const char* eval(Evaluator* eval, RegisterFrame* frame, const char* pc, Register* registers) {
+    pc = First::eval(eval, frame, pc, registers);
+    if (((OpHeader*) pc)->code == SecondCode) {
+      pc = Second::eval(eval, frame, pc, registers);
+    }
+    return pc;
+  }
+};
+
+// An exception escaped `frame`: make sure the Python error is set and add
+// the frame to the traceback.
+static void leave_frame(RegisterFrame* frame, const RException& error) {
+  Log_Info("ERROR: Leaving frame: %s", frame->str().c_str());
+
+  if (error.exception != NULL && !PyErr_Occurred()) {
+    PyErr_SetObject(error.exception, error.value);
+  }
+
+  PyFrameObject* py_frame = PyFrame_New(PyThreadState_GET(),
+      frame->code->code(),
+      frame->globals(),
+      frame->locals());
+  py_frame->f_lineno = 0;
+  PyTraceBack_Here(py_frame);
+}
+
+#if !USE_TAILCALL_DISPATCH
+
 #define DISPATCH_HEADER\
   dispatch_header: try {
 
@@ -1790,22 +3329,22 @@ struct RaiseVarArgs: public RegOpImpl<RegOp<3>, RaiseVarArgs> {
 
 #define JUMP_TO_NEXT goto dispatch_header;
 
-#define START_DISPATCH switch (((OpHeader*)pc)->code) {
+#define START_DISPATCH if (profiling_) profile_op(frame, pc); switch (((OpHeader*)pc)->code) {
 #define END_DISPATCH } JUMP_TO_NEXT
 
-#define FALLTHROUGH(opname) case opname:
 #define START_OP(opname) case opname: {
 #define END_OP(opname) break; }
 
 #else
-#define JUMP_TO_NEXT goto *labels[((OpHeader*)pc)->code]
+#if DIRECT_THREADING
+#define JUMP_TO_NEXT goto *((OpHeader*)pc)->handler
+#else
+#define JUMP_TO_NEXT goto *dispatch[((OpHeader*)pc)->code]
+#endif
 
 #define START_DISPATCH JUMP_TO_NEXT;
 #define END_DISPATCH
 
-#define _FALLTHROUGH(opname) op_ ## opname:
-#define FALLTHROUGH(opname) _FALLTHROUGH(opname)
-
 #define _START_OP(opname) op_##opname: {
 #define START_OP(opname) _START_OP(opname)
 #define END_OP(opname) JUMP_TO_NEXT; }
@@ -1838,19 +3377,69 @@ struct RaiseVarArgs: public RegOpImpl<RegOp<3>, RaiseVarArgs> {
     _DEFINE_OP(opname, BinaryOp<CONCAT(opname, objfn)>)\
     END_OP(opname)
 
+#define FUSED_OP(opname, first, second, second_code)\
+    START_OP(opname)\
+    _DEFINE_OP(opname, FusedOp<CONCAT(first, second, second_code)>)\
+    END_OP(opname)
+
 #define UNARY_OP2(opname, objfn)\
     START_OP(opname)\
     _DEFINE_OP(opname, UnaryOp<CONCAT(opname, objfn)>)\
     END_OP(opname)
 
-Register Evaluator::eval(RegisterFrame* f) {
-  register RegisterFrame* frame = f;
-  register Register* registers asm("r15") = frame->registers;
-  register const char* pc asm("r14") = frame->instructions();
+#if ENABLE_JIT
+#define ENTER_NATIVE\
+    if (!profiling_ && frame->code->jit != NULL) {\
+      jit = frame->code->jit;\
+      goto dispatch_header;\
+    }
+#else
+#define ENTER_NATIVE
+#endif
 
-  Reg_Assert(frame != NULL, "NULL frame object.");
-  Register* result;
+// A call to a compiled function continues in this loop with the callee's
+// frame; RETURN_VALUE switches back to the caller.
+#define _CALL_OP(impl)\
+    {\
+      RegisterFrame* callee = enter_call<impl>(this, frame, pc, registers);\
+      pc += ((VarRegOp*) pc)->size();\
+      if (callee != NULL) {\
+        frame = callee;\
+        registers = frame->registers;\
+        pc = frame->instructions();\
+        ENTER_NATIVE\
+      }\
+    }
+
+#define CALL_OP(opname, impl)\
+    START_OP(opname)\
+    _CALL_OP(impl)\
+    END_OP(opname)
+
+#define FUSED_CALL_OP(opname, first, second, second_code)\
+    START_OP(opname)\
+    pc = first::eval(this, frame, pc, registers);\
+    if (((OpHeader*) pc)->code == second_code) {\
+      _CALL_OP(second)\
+    }\
+    END_OP(opname)
 
+// Start the call at pc.  Returns the callee's frame, linked to its caller,
+// if the dispatch loop should run it.
+template<class CallOp>
+static inline f_inline RegisterFrame* enter_call(Evaluator* eval, RegisterFrame* frame, const char* pc, Register* registers) {
+  VarRegOp* op = (VarRegOp*) pc;
+  log_operation(frame, op, registers, pc);
+  RegisterFrame* callee = CallOp::call(eval, frame, op, registers);
+  if (callee != NULL) {
+    callee->caller = frame;
+    callee->return_pc = pc + op->size();
+    callee->return_reg = op->reg[op->num_registers - 1];
+  }
+  return callee;
+}
+
+Register Evaluator::eval(RegisterFrame* f) {
   // The index of each offset MUST correspond to the opcode number!
 #if USE_THREADED_DISPATCH == 1
   static const void* labels[] = {
@@ -2012,139 +3601,112 @@ Register Evaluator::eval(RegisterFrame* f) {
     OFFSET(DICT_CONTAINS),
     OFFSET(DICT_GET),
     OFFSET(DICT_GET_DEFAULT),
+    OFFSET(JUMP_ABSOLUTE_FOR_ITER),
+    OFFSET(LOAD_GLOBAL_CALL_FUNCTION),
+    OFFSET(FOR_ITER_MOVE),
+    OFFSET(MOVE_COMPARE_AND_BRANCH),
+    OFFSET(LOAD_ATTR_CALL_FUNCTION),
+    OFFSET(COMPARE_AND_BRANCH_FALSE),
+    OFFSET(COMPARE_AND_BRANCH_TRUE),
+    OFFSET(SETUP_RANGE),
+    OFFSET(FOR_RANGE),
+    OFFSET(JUMP_ABSOLUTE_FOR_RANGE),
+    OFFSET(FOR_RANGE_MOVE),
+    OFFSET(MOVE),
+    OFFSET(MOVE_N),
+    OFFSET(LOAD_METHOD),
+    OFFSET(CALL_METHOD),
+    OFFSET(LOAD_METHOD_CALL_METHOD),
   };
+
+#if !DIRECT_THREADING
+  // While profiling, every operation dispatches to op_profile first.
+  static const void* profile_labels[sizeof(labels) / sizeof(labels[0])];
+  if (profile_labels[0] == NULL) {
+    for (size_t i = 0; i < sizeof(labels) / sizeof(labels[0]); ++i) {
+      profile_labels[i] = &&op_profile;
+    }
+  }
+  const void* const* dispatch = profiling_ ? profile_labels : labels;
+#endif
+#endif
+
+#if DIRECT_THREADING
+  // Called with a NULL frame by the Evaluator constructor to publish the
+  // handler table for the compiler.
+  static const void* const profile_label[] = { &&op_profile };
+  if (f == NULL) {
+    op_handlers = labels;
+    num_op_handlers = sizeof(labels) / sizeof(labels[0]);
+    op_profile_handler = profile_label;
+    return Register();
+  }
+#endif
+
+  RegisterFrame* const entry = f;
+  register RegisterFrame* frame = f;
+  register Register* registers asm("r15") = frame->registers;
+  register const char* pc asm("r14") = frame->instructions();
+
+  Reg_Assert(frame != NULL, "NULL frame object.");
+  Register* result;
+
+#if ENABLE_JIT
+  JitFunction jit = profiling_ ? NULL : frame->code->jit;
 #endif
 
   DISPATCH_HEADER
+
+#if ENABLE_JIT
+  // Run native code if we have it; it returns here for RETURN_VALUE, or
+  // when an operation raises an exception.
+  if (jit != NULL) {
+    JitFunction native = jit;
+    jit = NULL;
+    pc = native(this, frame, registers);
+    if (pc == NULL) {
+      throw RException(jit_error);
+    }
+  }
+#endif
+
   START_DISPATCH
 
   START_OP(RETURN_VALUE)
   result = ReturnValue::eval(this, frame, pc, registers);
-  goto done;\
-END_OP(RETURN_VALUE)
+  if (frame == entry) {
+    goto done;
+  }
+  {
+    Register value = *result;
+    RegisterFrame* callee = frame;
+    frame = callee->caller;
+    registers = frame->registers;
+    pc = callee->return_pc;
+    int dst = callee->return_reg;
+    PyObject* instance = callee->instance;
+    callee->instance = NULL;
+    // The callee may overlap the result register.
+    leave_call(callee);
+    if (instance != NULL) {
+      value = constructed(instance, value);
+    }
+    STORE_REG(dst, value);
+  }
+  END_OP(RETURN_VALUE)
 
   START_OP(STOP_CODE)
   EVAL_LOG("Jump to invalid opcode.");
   throw RException(PyExc_SystemError, "Invalid jump.");
   END_OP(STOP_CODE)
 
-  BINARY_OP3(BINARY_MULTIPLY, PyNumber_Multiply, IntegerOps::mul, true);
-  BINARY_OP3(BINARY_DIVIDE, PyNumber_Divide, IntegerOps::div, true);
-  BINARY_OP3(BINARY_ADD, PyNumber_Add, IntegerOps::add, true);
-  BINARY_OP3(BINARY_SUBTRACT, PyNumber_Subtract, IntegerOps::sub, true);
-  BINARY_OP3(BINARY_OR, PyNumber_Or, IntegerOps::Or, false);
-  BINARY_OP3(BINARY_XOR, PyNumber_Xor, IntegerOps::Xor, false);
-  BINARY_OP3(BINARY_AND, PyNumber_And, IntegerOps::And, false);
-  BINARY_OP3(BINARY_RSHIFT, PyNumber_Rshift, IntegerOps::Rshift, false);
-  BINARY_OP3(BINARY_LSHIFT, PyNumber_Lshift, IntegerOps::Lshift, false);
-  BINARY_OP2(BINARY_TRUE_DIVIDE, PyNumber_TrueDivide);
-  BINARY_OP2(BINARY_FLOOR_DIVIDE, PyNumber_FloorDivide);
-
-  DEFINE_OP(BINARY_POWER, BinaryPower);
-  DEFINE_OP(BINARY_MODULO, BinaryModulo);
-
-  DEFINE_OP(BINARY_SUBSCR, BinarySubscr);
-  DEFINE_OP(BINARY_SUBSCR_LIST, BinarySubscrList);
-  DEFINE_OP(BINARY_SUBSCR_DICT, BinarySubscrDict);
-  DEFINE_OP(CONST_INDEX, ConstIndex);
-
-  BINARY_OP3(INPLACE_MULTIPLY, PyNumber_InPlaceMultiply, IntegerOps::mul, true);
-  BINARY_OP3(INPLACE_DIVIDE, PyNumber_InPlaceDivide, IntegerOps::div, true);
-  BINARY_OP3(INPLACE_ADD, PyNumber_InPlaceAdd, IntegerOps::add, true);
-  BINARY_OP3(INPLACE_SUBTRACT, PyNumber_InPlaceSubtract, IntegerOps::sub, true);
-  BINARY_OP3(INPLACE_MODULO, PyNumber_InPlaceRemainder, IntegerOps::mod, true);
-
-  BINARY_OP2(INPLACE_OR, PyNumber_InPlaceOr);
-  BINARY_OP2(INPLACE_XOR, PyNumber_InPlaceXor);
-  BINARY_OP2(INPLACE_AND, PyNumber_InPlaceAnd);
-  BINARY_OP2(INPLACE_RSHIFT, PyNumber_InPlaceRshift);
-  BINARY_OP2(INPLACE_LSHIFT, PyNumber_InPlaceLshift);
-  BINARY_OP2(INPLACE_TRUE_DIVIDE, PyNumber_InPlaceTrueDivide);
-  BINARY_OP2(INPLACE_FLOOR_DIVIDE, PyNumber_InPlaceFloorDivide);
-  DEFINE_OP(INPLACE_POWER, InplacePower);
-
-  UNARY_OP2(UNARY_INVERT, PyNumber_Invert);
-  UNARY_OP2(UNARY_CONVERT, PyObject_Repr);
-  UNARY_OP2(UNARY_NEGATIVE, PyNumber_Negative);
-  UNARY_OP2(UNARY_POSITIVE, PyNumber_Positive);
-
-  DEFINE_OP(UNARY_NOT, UnaryNot);
-
-  DEFINE_OP(LOAD_FAST, LoadFast);
-  DEFINE_OP(LOAD_LOCALS, LoadLocals);
-  DEFINE_OP(LOAD_NAME, LoadName);
-  DEFINE_OP(LOAD_ATTR, LoadAttr);
-
-  DEFINE_OP(STORE_NAME, StoreName);
-  DEFINE_OP(STORE_ATTR, StoreAttr);
-
-  DEFINE_OP(STORE_SUBSCR, StoreSubscr);
-  DEFINE_OP(STORE_SUBSCR_LIST, StoreSubscrList);
-  DEFINE_OP(STORE_SUBSCR_DICT, StoreSubscrDict);
-
-  DEFINE_OP(STORE_FAST, StoreFast);
-  DEFINE_OP(STORE_SLICE, StoreSlice);
-
-  DEFINE_OP(LOAD_GLOBAL, LoadGlobal);
-  DEFINE_OP(STORE_GLOBAL, StoreGlobal);
-  DEFINE_OP(DELETE_GLOBAL, DeleteGlobal);
-  DEFINE_OP(DELETE_NAME, DeleteName);
-
-  DEFINE_OP(LOAD_CLOSURE, LoadClosure);
-  DEFINE_OP(LOAD_DEREF, LoadDeref);
-  DEFINE_OP(STORE_DEREF, StoreDeref);
-
-  DEFINE_OP(GET_ITER, GetIter);
-  DEFINE_OP(FOR_ITER, ForIter);
-  DEFINE_OP(BREAK_LOOP, BreakLoop);
-
-  DEFINE_OP(BUILD_TUPLE, BuildTuple);
-  DEFINE_OP(BUILD_LIST, BuildList);
-  DEFINE_OP(BUILD_MAP, BuildMap);
-  DEFINE_OP(BUILD_SLICE, BuildSlice);
-
-  DEFINE_OP(STORE_MAP, StoreMap);
-
-  DEFINE_OP(PRINT_NEWLINE, PrintNewline);
-  DEFINE_OP(PRINT_NEWLINE_TO, PrintNewline);
-  DEFINE_OP(PRINT_ITEM, PrintItem);
-  DEFINE_OP(PRINT_ITEM_TO, PrintItem);
-
-  DEFINE_OP(CALL_FUNCTION, CallFunctionSimple);
-  DEFINE_OP(CALL_FUNCTION_VAR, CallFunctionVar);
-  DEFINE_OP(CALL_FUNCTION_KW, CallFunctionKw);
-  DEFINE_OP(CALL_FUNCTION_VAR_KW, CallFunctionVarKw);
-
-  FALLTHROUGH(POP_JUMP_IF_FALSE);
-  DEFINE_OP(JUMP_IF_FALSE_OR_POP, JumpIfFalseOrPop);
-
-  FALLTHROUGH(POP_JUMP_IF_TRUE);
-  DEFINE_OP(JUMP_IF_TRUE_OR_POP, JumpIfTrueOrPop);
-
-  DEFINE_OP(JUMP_ABSOLUTE, JumpAbsolute);
-  DEFINE_OP(COMPARE_OP, CompareOp);
-  DEFINE_OP(INCREF, IncRef);
-  DEFINE_OP(DECREF, DecRef);
-
-  DEFINE_OP(LIST_APPEND, ListAppend);
-
-  DEFINE_OP(DICT_CONTAINS, DictContains);
-  DEFINE_OP(DICT_GET, DictGet);
-  DEFINE_OP(DICT_GET_DEFAULT, DictGetDefault);
-
-  DEFINE_OP(SLICE, Slice);
-
-  DEFINE_OP(IMPORT_STAR, ImportStar);
-  DEFINE_OP(IMPORT_FROM, ImportFrom);
-  DEFINE_OP(IMPORT_NAME, ImportName);
-
-  DEFINE_OP(MAKE_FUNCTION, MakeFunction);
-  DEFINE_OP(MAKE_CLOSURE, MakeClosure);
-  DEFINE_OP(BUILD_CLASS, BuildClass);
+#if USE_THREADED_DISPATCH == 1
+  op_profile:
+  profile_op(frame, pc);
+  goto *labels[((OpHeader*)pc)->code];
+#endif
 
-  DEFINE_OP(SETUP_EXCEPT, SetupExcept);
-  DEFINE_OP(SETUP_FINALLY, SetupFinally);
-  DEFINE_OP(RAISE_VARARGS, RaiseVarArgs);
+#include "reval_ops.h"
 
   BAD_OP(SETUP_LOOP);
   BAD_OP(POP_BLOCK);
@@ -2159,7 +3721,6 @@ END_OP(RETURN_VALUE)
   BAD_OP(BUILD_SET);
   BAD_OP(DUP_TOPX);
   BAD_OP(DELETE_ATTR);
-  BAD_OP(UNPACK_SEQUENCE);
   BAD_OP(END_FINALLY);
   BAD_OP(YIELD_VALUE);
   BAD_OP(EXEC_STMT);
@@ -2177,25 +3738,24 @@ END_OP(RETURN_VALUE)
   END_DISPATCH
 
 } catch (const RException &error) {
-  if (!frame->exc_handlers_.empty()) {
-    int handler_offset = frame->exc_handlers_.pop();
-    EVAL_LOG("Jumping to handler: %d", handler_offset);
-    pc = frame->instructions() + handler_offset;
-    JUMP_TO_NEXT;
-  }
-  Log_Info("ERROR: Leaving frame: %s", frame->str().c_str());
-
-  if (error.exception != NULL && !PyErr_Occurred()) {
-    PyErr_SetObject(error.exception, error.value);
+  // Unwind to the innermost frame with a handler, or out of eval if there
+  // isn't one below the entry frame.
+  for (;;) {
+    if (!frame->exc_handlers_.empty()) {
+      int handler_offset = frame->exc_handlers_.pop();
+      EVAL_LOG("Jumping to handler: %d", handler_offset);
+      registers = frame->registers;
+      pc = frame->instructions() + handler_offset;
+      JUMP_TO_NEXT;
+    }
+    leave_frame(frame, error);
+    if (frame == entry) {
+      throw RException();
+    }
+    RegisterFrame* callee = frame;
+    frame = callee->caller;
+    leave_call(callee);
   }
-
-  PyFrameObject* py_frame = PyFrame_New(PyThreadState_GET(),
-      frame->code->code(),
-      frame->globals(),
-      frame->locals());
-  py_frame->f_lineno = 0;
-  PyTraceBack_Here(py_frame);
-  throw RException();
 }
   done: {
 //    EVAL_LOG("SUCCESS: Leaving frame: %s; result %s",
@@ -2203,3 +3763,217 @@ END_OP(RETURN_VALUE)
     return *result;
   }
 }
+
+#else
+
+// Tail-call dispatch.  Each operation is a separate function, ending with a
+// call to the handler for the next instruction.  Those calls are compiled as
+// jumps (guaranteed by musttail where the compiler has it, and by sibling
+// call optimization otherwise), so a chain of handlers runs in constant stack
+// space, and each handler gets its own register allocation instead of
+// sharing one with every other operation in a single huge function.
+//
+// RETURN_VALUE ends the chain by returning its register; exceptions unwind
+// back to Evaluator::eval, which restarts the chain at the frame's exception
+// handler.
+
+#if defined(__has_attribute)
+#if __has_attribute(musttail)
+#define MUSTTAIL __attribute__((musttail))
+#endif
+#endif
+
+#ifndef MUSTTAIL
+#ifndef __OPTIMIZE__
+#error "USE_TAILCALL_DISPATCH needs musttail support or an optimized build."
+#endif
+#define MUSTTAIL
+#endif
+
+typedef Register* (*TailHandler)(Evaluator* eval, RegisterFrame* frame, const char* pc, Register* registers);
+
+static TailHandler tail_handlers[256];
+
+#if !DIRECT_THREADING
+// tail_handlers, or tail_profile_handlers while profiling.
+static TailHandler tail_profile_handlers[256];
+static TailHandler* tail_dispatch = tail_handlers;
+#endif
+
+static f_inline TailHandler next_handler(const char* pc) {
+#if DIRECT_THREADING
+  return (TailHandler) ((OpHeader*) pc)->handler;
+#else
+  return tail_dispatch[((OpHeader*) pc)->code];
+#endif
+}
+
+static Register* tail_profile_op(Evaluator* eval, RegisterFrame* frame, const char* pc, Register* registers) {
+  eval->profile_op(frame, pc);
+  MUSTTAIL return tail_handlers[((OpHeader*) pc)->code](eval, frame, pc, registers);
+}
+
+template<class Impl>
+static Register* tail_handler(Evaluator* eval, RegisterFrame* frame, const char* pc, Register* registers) {
+  pc = Impl::eval(eval, frame, pc, registers);
+  MUSTTAIL return next_handler(pc)(eval, frame, pc, registers);
+}
+
+static Register* tail_return_value(Evaluator* eval, RegisterFrame* frame, const char* pc, Register* registers) {
+  return ReturnValue::eval(eval, frame, pc, registers);
+}
+
+static Register* tail_bad_op(Evaluator* eval, RegisterFrame* frame, const char* pc, Register* registers) {
+  EVAL_LOG("Jump to invalid opcode.");
+  throw RException(PyExc_SystemError, "Bad opcode %s", OpUtil::name(((OpHeader*) pc)->code));
+}
+
+#define TAIL_OP(opname, ...) tail_handlers[opname] = &tail_handler<__VA_ARGS__>
+#define DEFINE_OP(opname, impl) TAIL_OP(opname, impl)
+#define BINARY_OP3(opname, objfn, intfn, can_overflow)\
+    TAIL_OP(opname, BinaryOpWithSpecialization<opname, objfn, intfn, can_overflow>)
+#define BINARY_OP2(opname, objfn) TAIL_OP(opname, BinaryOp<opname, objfn>)
+#define UNARY_OP2(opname, objfn) TAIL_OP(opname, UnaryOp<opname, objfn>)
+#define FUSED_OP(opname, first, second, second_code) TAIL_OP(opname, FusedOp<first, second, second_code>)
+#define CALL_OP(opname, impl) DEFINE_OP(opname, impl)
+#define FUSED_CALL_OP(opname, first, second, second_code) FUSED_OP(opname, first, second, second_code)
+
+static struct TailHandlerInit {
+  TailHandlerInit() {
+    for (int i = 0; i < 256; ++i) {
+      tail_handlers[i] = &tail_bad_op;
+#if !DIRECT_THREADING
+      tail_profile_handlers[i] = &tail_profile_op;
+#endif
+    }
+    tail_handlers[RETURN_VALUE] = &tail_return_value;
+#include "reval_ops.h"
+  }
+} tail_handler_init;
+
+Register Evaluator::eval(RegisterFrame* f) {
+#if DIRECT_THREADING
+  if (f == NULL) {
+    op_handlers = (const void* const*) tail_handlers;
+    num_op_handlers = 256;
+    static const void* const profile_op = (const void*) &tail_profile_op;
+    op_profile_handler = &profile_op;
+    return Register();
+  }
+#endif
+
+  RegisterFrame* frame = f;
+  Register* registers = frame->registers;
+  const char* pc = frame->instructions();
+
+  Reg_Assert(frame != NULL, "NULL frame object.");
+
+#if ENABLE_JIT
+  JitFunction jit = profiling_ ? NULL : frame->code->jit;
+#endif
+
+  for (;;) {
+    try {
+#if ENABLE_JIT
+      if (jit != NULL) {
+        JitFunction native = jit;
+        jit = NULL;
+        pc = native(this, frame, registers);
+        if (pc == NULL) {
+          throw RException(jit_error);
+        }
+      }
+#endif
+      return *next_handler(pc)(this, frame, pc, registers);
+    } catch (const RException &error) {
+      if (frame->exc_handlers_.empty()) {
+        leave_frame(frame, error);
+        throw RException();
+      }
+      int handler_offset = frame->exc_handlers_.pop();
+      EVAL_LOG("Jumping to handler: %d", handler_offset);
+      pc = frame->instructions() + handler_offset;
+    }
+  }
+}
+
+#endif
+
+#if ENABLE_JIT
+// Wraps an operation for calls from native code, which exceptions can't
+// unwind through.
+template<class Impl>
+static const char* jit_handler(Evaluator* eval, RegisterFrame* frame, const char* pc, Register* registers) {
+  try {
+    return Impl::eval(eval, frame, pc, registers);
+  } catch (const RException& error) {
+    eval->jit_error = error;
+    return NULL;
+  }
+}
+
+#undef DEFINE_OP
+#undef BINARY_OP3
+#undef BINARY_OP2
+#undef UNARY_OP2
+#undef FUSED_OP
+#undef CALL_OP
+#undef FUSED_CALL_OP
+
+#define JIT_OP(opname, ...) handlers[opname] = &jit_handler<__VA_ARGS__>
+#define DEFINE_OP(opname, impl) JIT_OP(opname, impl)
+#define BINARY_OP3(opname, objfn, intfn, can_overflow)\
+    JIT_OP(opname, BinaryOpWithSpecialization<opname, objfn, intfn, can_overflow>)
+#define BINARY_OP2(opname, objfn) JIT_OP(opname, BinaryOp<opname, objfn>)
+#define UNARY_OP2(opname, objfn) JIT_OP(opname, UnaryOp<opname, objfn>)
+#define FUSED_OP(opname, first, second, second_code) JIT_OP(opname, FusedOp<first, second, second_code>)
+#define CALL_OP(opname, impl) DEFINE_OP(opname, impl)
+#define FUSED_CALL_OP(opname, first, second, second_code) FUSED_OP(opname, first, second, second_code)
+
+static const JitHandler* jit_handlers() {
+  static JitHandler handlers[256];
+  static bool initialized = false;
+  if (!initialized) {
+#include "reval_ops.h"
+    initialized = true;
+  }
+  return handlers;
+}
+#endif
+
+void Evaluator::enable_profiling(bool on) {
+  if (on && profile_ == NULL) {
+    profile_ = new OpProfile;
+  }
+  profiling_ = on;
+  compiler->set_profiling(on);
+#if USE_TAILCALL_DISPATCH && !DIRECT_THREADING
+  tail_dispatch = on ? tail_profile_handlers : tail_handlers;
+#endif
+}
+
+bool Evaluator::jit_available() {
+  return ENABLE_JIT;
+}
+
+bool Evaluator::jit_compile(PyObject* func) {
+#if ENABLE_JIT
+  if (PyMethod_Check(func)) {
+    func = PyMethod_GET_FUNCTION(func);
+  }
+  if (!PyFunction_Check(func)) {
+    throw RException(PyExc_TypeError, "Expected a function, got %s", obj_to_str(func));
+  }
+
+  RegisterCode* code = compiler->compile(func);
+  if (code == NULL) {
+    return false;
+  }
+  if (code->jit == NULL) {
+    code->jit = jit_register_code(code, jit_handlers());
+  }
+  return code->jit != NULL;
+#else
+  return false;
+#endif
+}
@@ -13,6 +13,7 @@
 #include "rinst.h"
 #include "rexcept.h"
 #include "rcompile.h"
+#include "rjit.h"
 
 
 // A vector which we can normally stack allocate, and which
@@ -93,17 +94,6 @@ struct SmallVector {
 
 typedef SmallVector<Register> ObjVector;
 
-struct Hint {
-  union {
-    PyObject* obj;
-    int dict_size;
-  } guard;
-
-  PyObject* key;
-  PyObject* value;
-  unsigned int version;
-};
-
 class Noncopyable {
 public:
   Noncopyable() {}
@@ -113,17 +103,110 @@ private:
   Noncopyable& operator=(const Noncopyable&);
 };
 
+// Storage for running frames' registers, handed out in call order from a
+// per-thread stack.  Each frame takes exactly the registers its code uses,
+// starting in its caller's argument window where it can, so nested calls are
+// packed together; when a chunk fills up, frames continue in the next one,
+// and chunks are kept for reuse once they empty.
+class RegisterPool: private Noncopyable {
+public:
+  // Registers per chunk, unless a single frame needs more.
+  static const size_t kChunkSize = 64 * 1024;
+
+  RegisterPool() : chunk_(NULL), free_frames_(NULL) {}
+  ~RegisterPool();
+
+  // The stack for the calling thread.
+  static RegisterPool* current();
+
+  f_inline Register* alloc(size_t count) {
+    if (chunk_ == NULL || chunk_->used + count > chunk_->size) {
+      next_chunk(count);
+    }
+    Register* regs = chunk_->base + chunk_->used;
+    chunk_->used += count;
+    return regs;
+  }
+
+  // The end of the registers handed out so far.
+  f_inline Register* top() const {
+    return chunk_ == NULL ? NULL : chunk_->base + chunk_->used;
+  }
+
+  // Hand out [start, start + count), where start is somewhere in the
+  // registers already handed out: a callee overlapping its caller's
+  // argument window.  Fails if the current chunk isn't big enough.
+  f_inline bool extend(Register* start, size_t count) {
+    Register* end = start + count;
+    if (chunk_ == NULL || start < chunk_->base || end > chunk_->base + chunk_->size) {
+      return false;
+    }
+    if (end > top()) {
+      chunk_->used = end - chunk_->base;
+    }
+    return true;
+  }
+
+  // Release regs, and everything allocated after it.
+  f_inline void release(Register* regs) {
+    chunk_->used = regs - chunk_->base;
+    if (chunk_->used == 0 && chunk_->prev != NULL) {
+      chunk_ = chunk_->prev;
+    }
+  }
+
+  // Frames are kept apart from their registers, which may start inside the
+  // caller's; released frames are kept for reuse.
+  f_inline void* alloc_frame() {
+    if (free_frames_ == NULL) {
+      return new_frame();
+    }
+    void* mem = free_frames_;
+    free_frames_ = *(void**) mem;
+    return mem;
+  }
+
+  f_inline void release_frame(void* mem) {
+    *(void**) mem = free_frames_;
+    free_frames_ = mem;
+  }
+
+private:
+  struct Chunk {
+    Register* base;
+    size_t size;
+    size_t used;
+    Chunk* prev;
+    Chunk* next;
+  };
+
+  void next_chunk(size_t count);
+  void* new_frame();
+
+  Chunk* chunk_;
+  void* free_frames_;
+};
+
 struct RegisterFrame: private Noncopyable {
 public:
-#if STACK_ALLOC_REGISTERS
-  Register registers[kMaxRegisters];
-  PyObject* freevars[8];
-#else
   Register* registers;
   PyObject** freevars;
-#endif
+  RegisterPool* pool_;
   const RegisterCode* code;
 
+  // Where the pool's registers ended before we were created.
+  Register* pool_mark_;
+
+  // For a call run in place by the dispatch loop: the calling frame, where
+  // it continues, and the register which receives our result.
+  RegisterFrame* caller;
+  const char* return_pc;
+  int return_reg;
+
+  // For the __init__ of a constructor call: the new instance, which the
+  // call returns in place of our None.
+  PyObject* instance;
+
   PyObject* builtins_;
   PyObject* globals_;
   PyObject* locals_;
@@ -149,10 +232,6 @@ public:
     return consts_;
   }
 
-  f_inline int num_consts() const {
-    return PyTuple_GET_SIZE(consts_) ;
-  }
-
   f_inline PyObject* names() {
     return names_;
   }
@@ -180,29 +259,105 @@ public:
     return w.str();
   }
 
-  RegisterFrame(RegisterCode* func, PyObject* obj, const ObjVector& args, const ObjVector& kw);
+  // Create a frame calling obj (the function, or a bound method, for
+  // `code`), with registers of its own from pool.  `kw` holds the name and
+  // value of each keyword argument in turn.  kw_slots, if given, has the
+  // parameter each keyword binds to, or -1 for one collected by **kwargs;
+  // otherwise they're looked up by name.
+  static RegisterFrame* create(RegisterPool* pool, RegisterCode* code, PyObject* obj, const ObjVector& args,
+                               const ObjVector& kw, const int* kw_slots = NULL);
+
+  // Create a frame whose registers start in its caller's argument window:
+  // `args` is the first argument register, and the caller's registers end at
+  // `caller_end`.  The arguments become the frame's parameters where they
+  // are, unless the pool has no room to extend the window, in which case
+  // they're moved to fresh registers.  The code must take a fixed number of
+  // arguments.
+  static RegisterFrame* create_in_window(RegisterPool* pool, RegisterCode* code, PyObject* obj, Register* args,
+                                         int num_args, Register* caller_end);
+  static void destroy(RegisterFrame* frame);
+
+private:
+  // Check a call to obj with num_args positional arguments, for code which
+  // takes a fixed number of arguments.
+  static void check_args(RegisterCode* code, PyObject* obj, int num_args);
+
+  static RegisterFrame* bind(RegisterPool* pool, RegisterCode* code, PyObject* obj, const ObjVector& args,
+                             const ObjVector& kw, const int* kw_slots);
+
+  // regs holds num_args parameters for a call to obj, and its first
+  // num_dirty registers are left over from the caller.
+  RegisterFrame(RegisterPool* pool, RegisterCode* code, PyObject* obj, Register* regs, int num_args, int num_dirty,
+                Register* mark);
   ~RegisterFrame();
 };
 
+// Dispatch statistics, collected while profiling is enabled.  Each dispatch
+// is counted, along with the pair it forms with the previous dispatch in the
+// same frame.  One in kSampleRate dispatches of each operation is timed with
+// rdtsc, up to the next dispatch.
+struct OpProfile {
+  static const int kSampleRate = 16;
+
+  int64_t counts[256];
+  int64_t cycles[256];
+  int64_t samples[256];
+  int64_t pairs[256][256];
+
+  RegisterFrame* last_frame;
+  int last_op;
+  int sample_op;
+  uint64_t sample_start;
+
+  OpProfile() {
+    clear();
+  }
+
+  void clear();
+};
+
 class Evaluator {
 public:
-  Hint hints[kMaxHints + 1];
-private:
-  void collect_info(int opcode);
-  int32_t op_counts_[256];
-  int64_t op_times_[256];
+  int64_t call_hits;
+  int64_t call_misses;
 
-  int64_t hint_hits_;
-  int64_t hint_misses_;
-
-  int32_t total_count_;
-  int64_t last_clock_;
+  // Argument tuples for METH_VARARGS calls to C functions, by size, kept for
+  // the next call of that size once the callee has let go of them.
+  static const int kMaxArgTuple = 8;
+  PyObject* arg_tuples[kMaxArgTuple + 1];
+private:
+  bool profiling_;
+  OpProfile* profile_;
 
 public:
   Evaluator();
   ~Evaluator();
   void dump_status();
 
+  // Profiling switches every operation over to a dispatch path which records
+  // it first; with profiling off, dispatch is unaffected.  Native code is not
+  // used while profiling.
+  void enable_profiling(bool on);
+  bool profiling() const {
+    return profiling_;
+  }
+  void clear_profile();
+
+  // The profile as a dict: 'counts' and 'cycles' (average per operation) map
+  // operation names to numbers, 'pairs' maps (first, second) name tuples to
+  // counts.
+  PyObject* op_profile();
+
+  // Call site cache statistics, as a dict of 'hits' and 'misses'.
+  PyObject* call_stats();
+
+  // For each site in func's code with a Hint, a dict of its instruction
+  // 'index', operation name 'op', 'name' (None unless it names an attribute
+  // or global), 'hits', 'misses', number of 'entries' and 'megamorphic'.
+  PyObject* hint_stats(PyObject* func);
+
+  inline void profile_op(RegisterFrame* frame, const char* pc);
+
   Register eval(RegisterFrame* rf);
 
   PyObject* eval_frame_to_pyobj(RegisterFrame* rf);
@@ -213,7 +368,18 @@ public:
   RegisterFrame* frame_from_pyfunc(PyObject* func, PyObject* args, PyObject* kw);
   RegisterFrame* frame_from_codeobj(PyObject* code);
 
+  // Compile func to native code; returns false if the JIT is unavailable or
+  // func uses an unsupported operation, in which case it is interpreted.
+  bool jit_compile(PyObject* func);
+
+  // Whether falcon was built with the JIT (see ENABLE_JIT).
+  bool jit_available();
+
   Compiler *compiler;
+
+  // The error raised by a handler called from native code, rethrown by the
+  // interpreter when the native code returns.
+  RException jit_error;
 };
 
 //void StartTracing(Evaluator*);
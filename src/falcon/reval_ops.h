@@ -0,0 +1,146 @@
+// The operations implemented by Evaluator::eval.
+//
+// This file is included once inside the dispatch loop, and once to build the
+// JIT's handler table, so the two can't drift apart.  The includer defines
+// DEFINE_OP, BINARY_OP3, BINARY_OP2, UNARY_OP2 and FUSED_OP, and CALL_OP and
+// FUSED_CALL_OP for calls, which the dispatch loop runs without recursing
+// when the callee is compiled.
+//
+// RETURN_VALUE, STOP_CODE and unsupported operations are handled directly by
+// the dispatch loop.
+
+BINARY_OP3(BINARY_MULTIPLY, PyNumber_Multiply, IntegerOps::mul, true);
+BINARY_OP3(BINARY_DIVIDE, PyNumber_Divide, IntegerOps::div, true);
+BINARY_OP3(BINARY_ADD, PyNumber_Add, IntegerOps::add, true);
+BINARY_OP3(BINARY_SUBTRACT, PyNumber_Subtract, IntegerOps::sub, true);
+BINARY_OP3(BINARY_OR, PyNumber_Or, IntegerOps::Or, false);
+BINARY_OP3(BINARY_XOR, PyNumber_Xor, IntegerOps::Xor, false);
+BINARY_OP3(BINARY_AND, PyNumber_And, IntegerOps::And, false);
+BINARY_OP3(BINARY_RSHIFT, PyNumber_Rshift, IntegerOps::Rshift, false);
+BINARY_OP3(BINARY_LSHIFT, PyNumber_Lshift, IntegerOps::Lshift, false);
+BINARY_OP2(BINARY_TRUE_DIVIDE, PyNumber_TrueDivide);
+BINARY_OP2(BINARY_FLOOR_DIVIDE, PyNumber_FloorDivide);
+
+DEFINE_OP(BINARY_POWER, BinaryPower);
+DEFINE_OP(BINARY_MODULO, BinaryModulo);
+
+DEFINE_OP(BINARY_SUBSCR, BinarySubscr);
+DEFINE_OP(BINARY_SUBSCR_LIST, BinarySubscrList);
+DEFINE_OP(BINARY_SUBSCR_DICT, BinarySubscrDict);
+DEFINE_OP(CONST_INDEX, ConstIndex);
+DEFINE_OP(UNPACK_SEQUENCE, UnpackSequence);
+
+BINARY_OP3(INPLACE_MULTIPLY, PyNumber_InPlaceMultiply, IntegerOps::mul, true);
+BINARY_OP3(INPLACE_DIVIDE, PyNumber_InPlaceDivide, IntegerOps::div, true);
+BINARY_OP3(INPLACE_ADD, PyNumber_InPlaceAdd, IntegerOps::add, true);
+BINARY_OP3(INPLACE_SUBTRACT, PyNumber_InPlaceSubtract, IntegerOps::sub, true);
+BINARY_OP3(INPLACE_MODULO, PyNumber_InPlaceRemainder, IntegerOps::mod, true);
+
+BINARY_OP2(INPLACE_OR, PyNumber_InPlaceOr);
+BINARY_OP2(INPLACE_XOR, PyNumber_InPlaceXor);
+BINARY_OP2(INPLACE_AND, PyNumber_InPlaceAnd);
+BINARY_OP2(INPLACE_RSHIFT, PyNumber_InPlaceRshift);
+BINARY_OP2(INPLACE_LSHIFT, PyNumber_InPlaceLshift);
+BINARY_OP2(INPLACE_TRUE_DIVIDE, PyNumber_InPlaceTrueDivide);
+BINARY_OP2(INPLACE_FLOOR_DIVIDE, PyNumber_InPlaceFloorDivide);
+DEFINE_OP(INPLACE_POWER, InplacePower);
+
+UNARY_OP2(UNARY_INVERT, PyNumber_Invert);
+UNARY_OP2(UNARY_CONVERT, PyObject_Repr);
+UNARY_OP2(UNARY_NEGATIVE, PyNumber_Negative);
+UNARY_OP2(UNARY_POSITIVE, PyNumber_Positive);
+
+DEFINE_OP(UNARY_NOT, UnaryNot);
+
+DEFINE_OP(LOAD_FAST, LoadFast);
+DEFINE_OP(LOAD_LOCALS, LoadLocals);
+DEFINE_OP(LOAD_NAME, LoadName);
+DEFINE_OP(LOAD_ATTR, LoadAttr);
+DEFINE_OP(LOAD_METHOD, LoadMethod);
+
+DEFINE_OP(STORE_NAME, StoreName);
+DEFINE_OP(STORE_ATTR, StoreAttr);
+
+DEFINE_OP(STORE_SUBSCR, StoreSubscr);
+DEFINE_OP(STORE_SUBSCR_LIST, StoreSubscrList);
+DEFINE_OP(STORE_SUBSCR_DICT, StoreSubscrDict);
+
+DEFINE_OP(STORE_FAST, StoreFast);
+DEFINE_OP(MOVE, Move);
+DEFINE_OP(MOVE_N, MoveN);
+DEFINE_OP(STORE_SLICE, StoreSlice);
+
+DEFINE_OP(LOAD_GLOBAL, LoadGlobal);
+DEFINE_OP(STORE_GLOBAL, StoreGlobal);
+DEFINE_OP(DELETE_GLOBAL, DeleteGlobal);
+DEFINE_OP(DELETE_NAME, DeleteName);
+
+DEFINE_OP(LOAD_CLOSURE, LoadClosure);
+DEFINE_OP(LOAD_DEREF, LoadDeref);
+DEFINE_OP(STORE_DEREF, StoreDeref);
+
+DEFINE_OP(GET_ITER, GetIter);
+DEFINE_OP(FOR_ITER, ForIter);
+DEFINE_OP(SETUP_RANGE, SetupRange);
+DEFINE_OP(FOR_RANGE, ForRange);
+DEFINE_OP(BREAK_LOOP, BreakLoop);
+
+DEFINE_OP(BUILD_TUPLE, BuildTuple);
+DEFINE_OP(BUILD_LIST, BuildList);
+DEFINE_OP(BUILD_MAP, BuildMap);
+DEFINE_OP(BUILD_SLICE, BuildSlice);
+
+DEFINE_OP(STORE_MAP, StoreMap);
+
+DEFINE_OP(PRINT_NEWLINE, PrintNewline);
+DEFINE_OP(PRINT_NEWLINE_TO, PrintNewline);
+DEFINE_OP(PRINT_ITEM, PrintItem);
+DEFINE_OP(PRINT_ITEM_TO, PrintItem);
+
+CALL_OP(CALL_FUNCTION, CallFunctionSimple);
+CALL_OP(CALL_FUNCTION_VAR, CallFunctionVar);
+CALL_OP(CALL_FUNCTION_KW, CallFunctionKw);
+CALL_OP(CALL_FUNCTION_VAR_KW, CallFunctionVarKw);
+CALL_OP(CALL_METHOD, CallMethod);
+
+DEFINE_OP(POP_JUMP_IF_FALSE, JumpIfFalseOrPop);
+DEFINE_OP(JUMP_IF_FALSE_OR_POP, JumpIfFalseOrPop);
+
+DEFINE_OP(POP_JUMP_IF_TRUE, JumpIfTrueOrPop);
+DEFINE_OP(JUMP_IF_TRUE_OR_POP, JumpIfTrueOrPop);
+
+DEFINE_OP(JUMP_ABSOLUTE, JumpAbsolute);
+DEFINE_OP(COMPARE_OP, CompareOp);
+DEFINE_OP(COMPARE_AND_BRANCH_FALSE, CompareAndBranch<false>);
+DEFINE_OP(COMPARE_AND_BRANCH_TRUE, CompareAndBranch<true>);
+DEFINE_OP(INCREF, IncRef);
+DEFINE_OP(DECREF, DecRef);
+
+DEFINE_OP(LIST_APPEND, ListAppend);
+
+DEFINE_OP(DICT_CONTAINS, DictContains);
+DEFINE_OP(DICT_GET, DictGet);
+DEFINE_OP(DICT_GET_DEFAULT, DictGetDefault);
+
+FUSED_OP(JUMP_ABSOLUTE_FOR_ITER, JumpAbsolute, ForIter, FOR_ITER);
+FUSED_CALL_OP(LOAD_GLOBAL_CALL_FUNCTION, LoadGlobal, CallFunctionSimple, CALL_FUNCTION);
+FUSED_OP(FOR_ITER_MOVE, ForIter, Move, MOVE);
+FUSED_OP(MOVE_COMPARE_AND_BRANCH, Move, CompareAndBranch<false>, COMPARE_AND_BRANCH_FALSE);
+FUSED_CALL_OP(LOAD_ATTR_CALL_FUNCTION, LoadAttr, CallFunctionSimple, CALL_FUNCTION);
+FUSED_CALL_OP(LOAD_METHOD_CALL_METHOD, LoadMethod, CallMethod, CALL_METHOD);
+FUSED_OP(JUMP_ABSOLUTE_FOR_RANGE, JumpAbsolute, ForRange, FOR_RANGE);
+FUSED_OP(FOR_RANGE_MOVE, ForRange, Move, MOVE);
+
+DEFINE_OP(SLICE, Slice);
+
+DEFINE_OP(IMPORT_STAR, ImportStar);
+DEFINE_OP(IMPORT_FROM, ImportFrom);
+DEFINE_OP(IMPORT_NAME, ImportName);
+
+DEFINE_OP(MAKE_FUNCTION, MakeFunction);
+DEFINE_OP(MAKE_CLOSURE, MakeClosure);
+DEFINE_OP(BUILD_CLASS, BuildClass);
+
+DEFINE_OP(SETUP_EXCEPT, SetupExcept);
+DEFINE_OP(SETUP_FINALLY, SetupFinally);
+DEFINE_OP(RAISE_VARARGS, RaiseVarArgs);
@@ -1,4 +1,7 @@
 #include "rinst.h"
+#include "rjit.h"
+
+#include <string.h>
 
 static bool objstr_enabled() {
   static bool _enabled = getenv("WITH_OBJSTR") != NULL;
@@ -48,10 +51,91 @@ std::string BranchOp<num_registers>::str(Register* registers) const {
     print_register(w, registers, reg[i]);
   }
   w.printf(")");
+#if DIRECT_THREADING
+  w.printf(" -> [%p]", label);
+#else
   w.printf(" -> [%d]", label);
+#endif
   return w.str();
 }
 
+void RegisterCode::plan_frame(const std::vector<int>& used_consts) {
+  PyCodeObject* co = code();
+  num_params = co->co_argcount;
+  num_locals = co->co_nlocals;
+  num_consts = used_consts.size();
+  fixed_args = !(co->co_flags & (CO_VARARGS | CO_VARKEYWORDS));
+
+  const_regs.resize(num_consts);
+  for (int i = 0; i < num_consts; ++i) {
+    const_regs[i].store_borrowed(PyTuple_GET_ITEM(co->co_consts, used_consts[i]));
+  }
+
+  int num_named = num_params + ((co->co_flags & CO_VARARGS) ? 1 : 0) + ((co->co_flags & CO_VARKEYWORDS) ? 1 : 0);
+  cell_params.assign(num_cellvars, -1);
+  for (int i = 0; i < num_cellvars; ++i) {
+    char* cellname = PyString_AS_STRING(PyTuple_GET_ITEM(co->co_cellvars, i));
+    for (int j = 0; j < num_named; ++j) {
+      if (strcmp(cellname, PyString_AS_STRING(PyTuple_GET_ITEM(co->co_varnames, j))) == 0) {
+        cell_params[i] = j;
+        break;
+      }
+    }
+  }
+
+  defaults = NULL;
+  first_default = num_params;
+  check_defaults(function);
+}
+
+int RegisterCode::param_slot(PyObject* name) const {
+  // Parameter names are interned, and keyword names nearly always are.
+  PyObject* varnames = code()->co_varnames;
+  for (int i = 0; i < num_params; ++i) {
+    if (PyTuple_GET_ITEM(varnames, i) == name) {
+      return i;
+    }
+  }
+  if (!PyString_Check(name)) {
+    return -1;
+  }
+  for (int i = 0; i < num_params; ++i) {
+    if (_PyString_Eq(PyTuple_GET_ITEM(varnames, i), name)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void RegisterCode::plan_defaults(PyObject* def_args) {
+  // Keep the tuple alive, so a new one can't reuse its address.
+  Py_XINCREF(def_args);
+  Py_XDECREF(defaults);
+  defaults = def_args;
+  first_default = num_params - (def_args == NULL ? 0 : PyTuple_GET_SIZE(def_args));
+}
+
+RegisterCode::~RegisterCode() {
+  for (size_t i = 0; i < hints.size(); ++i) {
+    hints[i].drop_entries();
+  }
+  Py_XDECREF(defaults);
+#if ENABLE_JIT
+  if (jit != NULL) {
+    jit_release(jit);
+  }
+#endif
+}
+
+void RegisterCode::set_profiling(bool on) {
+#if DIRECT_THREADING
+  for (size_t i = 0; i < offsets.size(); ++i) {
+    OpHeader* op = (OpHeader*) &instructions[offsets[i]];
+    op->handler = on ? *op_profile_handler : op_handlers[op->code];
+  }
+#endif
+}
+
 template class RegOp<0> ;
 template class RegOp<1> ;
 template class RegOp<2> ;
@@ -62,3 +146,4 @@ template class RegOp<4> ;
 template class BranchOp<0> ;
 template class BranchOp<1> ;
 template class BranchOp<2> ;
+template class BranchOp<3> ;
@@ -10,6 +10,7 @@
 #include "register.h"
 
 #include <string>
+#include <vector>
 
 static const inline char* obj_to_str(PyObject* o) {
   if (o == NULL) {
@@ -72,15 +73,127 @@ static const int kMaxRegisters = MAX_REGISTERS;
 static const RegisterOffset kInvalidRegister = (RegisterOffset) -1;
 
 typedef uint16_t JumpLoc;
-typedef void* JumpAddr;
+typedef const char* JumpAddr;
+
+#if DIRECT_THREADING
+// The address of each opcode's handler in Evaluator::eval (or its handler
+// function, with USE_TAILCALL_DISPATCH), indexed by opcode.  Published by the
+// first Evaluator; lowering copies these into each instruction.
+extern const void* const* op_handlers;
+extern int num_op_handlers;
+
+// The handler every instruction uses while profiling, kept where
+// op_handlers is.
+extern const void* const* op_profile_handler;
+#endif
 
-typedef uint8_t HintOffset;
-static const uint8_t kMaxHints = 223;
-static const uint8_t kInvalidHint = kMaxHints;
+// Each operation OpUtil::has_hint picks out gets its own entry in the hints
+// of its RegisterCode.
+typedef uint16_t HintOffset;
+static const HintOffset kInvalidHint = (HintOffset) -1;
 
-static inline size_t hint_offset(void* obj, void* name) {
-  return ((size_t(obj) ^ size_t(name)) >> 4) % kMaxHints;
-}
+// What a site found for a key, or pair of keys:
+//
+// LOAD_GLOBAL: the globals; the name was at `slot` in `value`, the globals or
+// the builtins.
+//
+// Attributes: the object's type, which had `value` (borrowed) for the name,
+// of AttrKind `kind`, while its version tag was `tag`; the instance
+// dictionary last had the name at `slot`.
+//
+// Calls: the function called, with `value` its code object and `data` its
+// compiled code; or the type constructed, with `value` its Python __init__
+// and `data` the compiled __init__ while its version tag was `tag`.  Once
+// `kind` is set, `params` has the parameter of `data` each of the call's
+// keywords binds to (see keyword_slots).
+//
+// Binary operations: the operand types, with `data` the slot function which
+// does the operation for them, if there is one.
+struct HintEntry {
+  static const int kMaxKeywords = sizeof(size_t);
+
+  const void* key;
+  const void* key2;
+  PyObject* value;
+  void* data;
+  union {
+    size_t slot;
+    int8_t params[kMaxKeywords];
+  };
+  unsigned int tag;
+  int kind;
+
+  // A reference the entry holds (for calls, to the function, so no other
+  // object can take its place at the same address), or NULL.
+  PyObject* owned;
+};
+
+// A site's polymorphic inline cache: an entry for each of the first kEntries
+// keys it sees.  A site which sees more is megamorphic: it drops its entries
+// and stops caching.
+struct Hint {
+  static const int kEntries = 4;
+
+  HintEntry entries[kEntries];
+  int num_entries;
+  bool megamorphic;
+
+  // For attributes, the instance dictionary slot the name was last found at
+  // for a type without an entry.
+  size_t slot;
+
+  // How often the site found what it needed in its entries, and how often
+  // it had to look it up.
+  int64_t hits;
+  int64_t misses;
+
+  f_inline HintEntry* find(const void* key, const void* key2 = NULL) {
+    for (int i = 0; i < num_entries; ++i) {
+      if (entries[i].key == key && entries[i].key2 == key2) {
+        return &entries[i];
+      }
+    }
+    return NULL;
+  }
+
+  // The entry to fill in for key: the one it has, or a new one.  Returns NULL
+  // once the site is megamorphic.
+  HintEntry* entry_for(const void* key, const void* key2 = NULL) {
+    HintEntry* e = find(key, key2);
+    if (e != NULL || megamorphic) {
+      return e;
+    }
+    if (num_entries == kEntries) {
+      drop_entries();
+      return NULL;
+    }
+    e = &entries[num_entries++];
+    bzero(e, sizeof(*e));
+    e->key = key;
+    e->key2 = key2;
+    return e;
+  }
+
+  void drop_entries() {
+    // Releasing a reference may run code which comes back to this site.
+    int n = num_entries;
+    megamorphic = true;
+    num_entries = 0;
+    for (int i = 0; i < n; ++i) {
+      PyObject* owned = entries[i].owned;
+      entries[i].owned = NULL;
+      Py_XDECREF(owned);
+    }
+  }
+};
+
+class Evaluator;
+struct RegisterFrame;
+
+// Native code generated for a RegisterCode by the JIT (see rjit.h).  Returns
+// the instruction to continue interpreting at, or NULL if an exception was
+// raised.
+typedef const char* (*JitFunction)(Evaluator* eval, RegisterFrame* frame, Register* registers);
 
 struct RegisterCode {
   int16_t num_registers;
@@ -99,6 +212,33 @@ struct RegisterCode {
   int16_t num_cellvars;
   int16_t num_cells;
 
+  // The first register of the argument window (see ArgumentWindows), or -1
+  // if the code makes no calls through one, and its size: the register for
+  // self and one for each argument of the largest call planned for it.
+  int16_t window;
+  int16_t window_size;
+
+  // How to set up a frame, worked out once by plan_frame: the parameters
+  // (including self for a method), the registers holding locals and
+  // constants, and whether the code takes *args or **kwargs.
+  int16_t num_params;
+  int16_t num_locals;
+  int16_t num_consts;
+  bool fixed_args;
+
+  // The defaults tuple of the function last called, and the first parameter
+  // it supplies.
+  PyObject* defaults;
+  int16_t first_default;
+
+  // The constants the code uses, as they are stored in registers.  Frames
+  // borrow them from co_consts (with typed registers, ints are just tagged):
+  // they are never released or overwritten.
+  std::vector<Register> const_regs;
+
+  // For each cell variable, the parameter it starts out with, or -1.
+  std::vector<int16_t> cell_params;
+
   PyCodeObject* code() const {
     return (PyCodeObject*) code_;
   }
@@ -116,22 +256,69 @@ struct RegisterCode {
   }
 
   std::string instructions;
+
+  // The offset of each instruction in `instructions`, in order.
+  std::vector<int> offsets;
+
+  // One hint for each instruction with a hint_pos, in order.  Hints are
+  // updated as the code runs.
+  mutable std::vector<Hint> hints;
+
+  // Native code for this function, or NULL if it has not been JIT compiled.
+  JitFunction jit;
+
+  // Point every instruction at op_profile_handler, or back at its own
+  // handler.
+  void set_profiling(bool on);
+
+  // Releases what the hints and defaults hold, and the native code.
+  ~RegisterCode();
+
+  void plan_frame(const std::vector<int>& used_consts);
+
+  // The parameter called `name`, or -1 if there isn't one.
+  int param_slot(PyObject* name) const;
+
+  // The defaults can be replaced at any time, and functions sharing the code
+  // (closures, say) have their own, so frames check those of the function
+  // they call.
+  f_inline void check_defaults(PyObject* func) {
+    PyObject* def_args = func != NULL ? PyFunction_GET_DEFAULTS(func) : NULL;
+    if (def_args != defaults) {
+      plan_defaults(def_args);
+    }
+  }
+
+  void plan_defaults(PyObject* def_args);
 };
 
 #if PACK_INSTRUCTIONS
 #pragma pack(push, 0)
 #endif
 
+// With DIRECT_THREADING every instruction starts with the address of its
+// handler, and branch labels hold absolute addresses instead of offsets from
+// the start of the instruction stream.
+#if DIRECT_THREADING
+#define OP_HANDLER const void* handler;
+#define OP_LABEL JumpAddr label;
+#else
+#define OP_HANDLER
+#define OP_LABEL JumpLoc label;
+#endif
+
 struct OpHeader {
+  OP_HANDLER
   uint8_t code;
   uint16_t arg;
 };
 
 template<int kNumRegisters>
 struct BranchOp {
+  OP_HANDLER
   uint8_t code;
   uint16_t arg;
-  JumpLoc label;
+  OP_LABEL
   RegisterOffset reg[kNumRegisters];
 
   std::string str(Register* registers = NULL) const;
@@ -143,12 +330,14 @@ struct BranchOp {
 
 template<int kNumRegisters>
 struct RegOp {
+  OP_HANDLER
   uint8_t code;
   uint16_t arg;
 
 #if GETATTR_HINTS
   // The hint field is used by certain operations to cache information
-  // at runtime.  It is default initialized to kInvalidHint;
+  // at runtime: it is the index of their entry in RegisterCode::hints, or
+  // kInvalidHint.
   HintOffset hint_pos;
 #endif
 
@@ -164,11 +353,18 @@ struct RegOp {
 // A variable size instruction can contain any number of registers off the end
 // of the structure.
 struct VarRegOp {
+  OP_HANDLER
   uint8_t code;
   // arg has to be larger than uint8_t because
   // Python uses a weird encoding for keyword arg
   // function calls
   uint16_t arg;
+
+#if GETATTR_HINTS
+  // As for RegOp, which this has to line up with.
+  HintOffset hint_pos;
+#endif
+
   uint8_t num_registers;
   RegisterOffset reg[0];
 
@@ -0,0 +1,224 @@
+#include "rjit.h"
+
+#if ENABLE_JIT
+
+#include <string.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+
+#include "oputil.h"
+#include "rexcept.h"
+
+// Native code is mapped after a header recording what jit_release frees.
+struct JitHeader {
+  size_t size;
+  void** targets;
+};
+
+// Just enough of an x86-64 assembler for the code we emit.  eval, frame and
+// registers live in the callee-saved rbx, r12 and r13 for the life of the
+// function.
+struct CodeBuffer {
+  std::string code;
+
+  size_t size() const {
+    return code.size();
+  }
+
+  void emit(const char* bytes, size_t len) {
+    code.append(bytes, len);
+  }
+
+  void imm32(int32_t v) {
+    emit((const char*) &v, sizeof(v));
+  }
+
+  void imm64(uint64_t v) {
+    emit((const char*) &v, sizeof(v));
+  }
+
+  // movabs reg, imm64 (reg: 0 = rax, 1 = rcx, 2 = rdx)
+  void load_imm(int reg, const void* v) {
+    const char op[] = { '\x48', (char) (0xb8 + reg) };
+    emit(op, 2);
+    imm64((uint64_t) v);
+  }
+
+  // Emit a rel32 jump/branch with a placeholder target, returning the
+  // position of the displacement for patch().
+  size_t jmp() {
+    emit("\xe9", 1);
+    imm32(0);
+    return size() - 4;
+  }
+
+  size_t jne() {
+    emit("\x0f\x85", 2);
+    imm32(0);
+    return size() - 4;
+  }
+
+  size_t jz() {
+    emit("\x0f\x84", 2);
+    imm32(0);
+    return size() - 4;
+  }
+
+  void patch(size_t pos, size_t target) {
+    int32_t rel = (int32_t) (target - (pos + 4));
+    memcpy(&code[pos], &rel, sizeof(rel));
+  }
+};
+
+static int label_offset(const RegisterCode* code, const char* pc) {
+  const BranchOp<0>* op = (const BranchOp<0>*) pc;
+#if DIRECT_THREADING
+  return (int) (op->label - code->instructions.data());
+#else
+  return op->label;
+#endif
+}
+
+// Superinstructions only save dispatches, which native code doesn't have, so
+// we translate the ops separately: each instruction is called with the
+// handler for the first half of its pair.
+static int jit_opcode(const char* pc) {
+  return OpUtil::unfused(((OpHeader*) pc)->code);
+}
+
+JitFunction jit_register_code(RegisterCode* code, const JitHandler* handlers) {
+  const std::vector<int>& offsets = code->offsets;
+  const char* base = code->instructions.data();
+  size_t n_ops = offsets.size();
+
+  for (size_t i = 0; i < n_ops; ++i) {
+    int opcode = jit_opcode(base + offsets[i]);
+    if (opcode != RETURN_VALUE && opcode != JUMP_ABSOLUTE && handlers[opcode] == NULL) {
+      Log_Info("Not compiling %s: no handler for %s", obj_to_str(code->code()->co_name), OpUtil::name(opcode));
+      return NULL;
+    }
+  }
+
+  // Native address of the code for each instruction offset, for branches
+  // whose target isn't known until runtime.
+  void** targets = (void**) calloc(code->instructions.size() + 1, sizeof(void*));
+
+  CodeBuffer buf;
+  std::vector<size_t> native(n_ops);
+  std::vector<std::pair<size_t, int> > jumps;
+  std::vector<size_t> to_resolve;
+  std::vector<size_t> to_exit;
+
+  // push rbx; push r12; push r13; mov rbx, rdi; mov r12, rsi; mov r13, rdx
+  buf.emit("\x53\x41\x54\x41\x55", 5);
+  buf.emit("\x48\x89\xfb\x49\x89\xf4\x49\x89\xd5", 9);
+
+  for (size_t i = 0; i < n_ops; ++i) {
+    native[i] = buf.size();
+    const char* pc = base + offsets[i];
+    const char* next = base + (i + 1 < n_ops ? offsets[i + 1] : code->instructions.size());
+    int opcode = jit_opcode(pc);
+
+    if (opcode == RETURN_VALUE) {
+      buf.load_imm(0, pc);
+      to_exit.push_back(buf.jmp());
+      continue;
+    }
+
+    if (opcode == JUMP_ABSOLUTE) {
+      jumps.push_back(std::make_pair(buf.jmp(), label_offset(code, pc)));
+      continue;
+    }
+
+    // mov rdi, rbx; mov rsi, r12; movabs rdx, pc; mov rcx, r13
+    buf.emit("\x48\x89\xdf\x4c\x89\xe6", 6);
+    buf.load_imm(2, pc);
+    buf.emit("\x4c\x89\xe9", 3);
+    // movabs rax, handler; call rax
+    buf.load_imm(0, (const void*) handlers[opcode]);
+    buf.emit("\xff\xd0", 2);
+
+    if (OpUtil::is_branch(opcode)) {
+      // Fall through if the handler returned the next instruction.
+      // movabs rdx, next; cmp rax, rdx; jne resolve
+      buf.load_imm(2, next);
+      buf.emit("\x48\x39\xd0", 3);
+      to_resolve.push_back(buf.jne());
+    } else {
+      // Anything else always continues with the next instruction, unless it
+      // raised an exception.
+      // test rax, rax; jz exit
+      buf.emit("\x48\x85\xc0", 3);
+      to_exit.push_back(buf.jz());
+    }
+  }
+
+  // resolve: rax is NULL (error) or the next instruction to run.
+  size_t resolve = buf.size();
+  // test rax, rax; jz exit
+  buf.emit("\x48\x85\xc0", 3);
+  to_exit.push_back(buf.jz());
+  // mov rdx, rax; movabs rcx, base; sub rdx, rcx
+  buf.emit("\x48\x89\xc2", 3);
+  buf.load_imm(1, base);
+  buf.emit("\x48\x29\xca", 3);
+  // movabs rcx, targets; mov rcx, [rcx + rdx * 8]; test rcx, rcx; jz exit
+  buf.load_imm(1, targets);
+  buf.emit("\x48\x8b\x0c\xd1", 4);
+  buf.emit("\x48\x85\xc9", 3);
+  to_exit.push_back(buf.jz());
+  // jmp rcx
+  buf.emit("\xff\xe1", 2);
+
+  // exit: return rax to the interpreter.
+  size_t exit = buf.size();
+  // pop r13; pop r12; pop rbx; ret
+  buf.emit("\x41\x5d\x41\x5c\x5b\xc3", 6);
+
+  for (size_t i = 0; i < to_resolve.size(); ++i) {
+    buf.patch(to_resolve[i], resolve);
+  }
+  for (size_t i = 0; i < to_exit.size(); ++i) {
+    buf.patch(to_exit[i], exit);
+  }
+  for (size_t i = 0; i < jumps.size(); ++i) {
+    std::vector<int>::const_iterator target = std::lower_bound(offsets.begin(), offsets.end(), jumps[i].second);
+    Reg_Assert(target != offsets.end() && *target == jumps[i].second, "Jump to the middle of an instruction: %d",
+               jumps[i].second);
+    buf.patch(jumps[i].first, native[target - offsets.begin()]);
+  }
+
+  const size_t size = sizeof(JitHeader) + buf.size();
+  void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    free(targets);
+    throw RException(PyExc_MemoryError, "Failed to allocate memory for native code.");
+  }
+  JitHeader* header = (JitHeader*) mem;
+  header->size = size;
+  header->targets = targets;
+  char* entry = (char*) (header + 1);
+  memcpy(entry, buf.code.data(), buf.size());
+  if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(mem, size);
+    free(targets);
+    throw RException(PyExc_SystemError, "Failed to make native code executable.");
+  }
+
+  for (size_t i = 0; i < n_ops; ++i) {
+    targets[offsets[i]] = entry + native[i];
+  }
+
+  Log_Info("JIT compiled %s: %d operations, %d bytes.", obj_to_str(code->code()->co_name), n_ops, buf.size());
+  return (JitFunction) entry;
+}
+
+void jit_release(JitFunction jit) {
+  JitHeader* header = (JitHeader*) jit - 1;
+  free(header->targets);
+  munmap(header, header->size);
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef RJIT_H_
+#define RJIT_H_
+
+#include "config.h"
+#include "rinst.h"
+
+// A baseline JIT for register code.
+//
+// Each instruction is translated to a call to the evaluator's handler for
+// that opcode (the same RegOpImpl/BranchOpImpl code used by the dispatch
+// loop), with the instruction address baked into the call.  Control flow
+// between instructions is native: a handler returning the following
+// instruction falls through, JUMP_ABSOLUTE becomes a direct jump, and any
+// other result is looked up in a table mapping instructions to native code.
+//
+// The generated function returns to the interpreter for RETURN_VALUE, and
+// when a handler raises an exception (handlers return NULL, and the
+// evaluator rethrows the error so exception handlers work as usual).
+//
+// This is experimental, and off unless built with ENABLE_JIT=1: with every
+// instruction still a call, it saves only the dispatch itself, and runs no
+// faster than the threaded interpreter.
+
+// Evaluates the instruction at pc, returning the next instruction to
+// execute, or NULL if an exception was raised.
+typedef const char* (*JitHandler)(Evaluator* eval, RegisterFrame* frame, const char* pc, Register* registers);
+
+#if ENABLE_JIT
+// Translate `code` to native code using `handlers`, indexed by opcode.
+// Returns NULL if the code uses an operation without a handler.
+JitFunction jit_register_code(RegisterCode* code, const JitHandler* handlers);
+
+// Free native code from jit_register_code, once its RegisterCode is gone.
+void jit_release(JitFunction jit);
+#endif
+
+#endif /* RJIT_H_ */
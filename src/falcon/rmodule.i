@@ -22,4 +22,12 @@ public:
   ~Evaluator();
   PyObject* eval_python(PyObject* func, PyObject* args, PyObject* kw);
   PyObject* eval_python_module(PyObject* code, PyObject* module_dict);
+  bool jit_compile(PyObject* func);
+  bool jit_available();
+
+  void enable_profiling(bool on);
+  void clear_profile();
+  PyObject* op_profile();
+  PyObject* call_stats();
+  PyObject* hint_stats(PyObject* func);
 };
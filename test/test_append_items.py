@@ -11,3 +11,16 @@ def test_append_items():
 
 
 
+
+@wrap
+def store_items(n):
+  x = []
+  for i in range(n):
+    x.append(i << 40)
+  for i in range(1, n):
+    x[i] ^= x[i - 1]
+  x[-1] = -1
+  return x
+
+def test_store_items():
+  store_items(10)
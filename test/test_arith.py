@@ -31,4 +31,42 @@ def inplace_add(x):
 def test_inplace_add():
   a = [0]
   inplace_add(a) 
-  
\ No newline at end of file
+  
+
+
+def plus(a, b):
+  return a + b
+
+def minus(a, b):
+  return a - b
+
+def accumulate(x, items):
+  for item in items:
+    x += item
+  return x
+
+@wrap
+def operand_types():
+  # The same operations see more pairs of operand types than they cache.
+  pairs = [(1.5, 2.25), ('a', 'b'), ([1], [2]), ((1,), (2,)), (u'x', u'y'), (2 ** 70, 3),
+           (2 ** 70, 2 ** 65), (1j, 2j), (3, 4.5), (True, True)]
+  return ([plus(a, b) for a, b in pairs], [minus(a, b) for a, b in pairs[-5:]],
+          accumulate([], [[1], [2, 3]]), accumulate('', 'abc'), accumulate(0.5, [1.5, 2.5]))
+
+def test_operand_types():
+  operand_types()
+
+def divide(a, b):
+  return a / b
+
+def raised(f, *args):
+  try:
+    f(*args)
+  except Exception as e:
+    return type(e)
+
+def test_bad_operands():
+  import falcon
+  for f, a, b in ((plus, 1.0, 2.0), (plus, 1.0, 'x'), (plus, 'x', 1), (plus, [], ()), (minus, 'a', 'b'),
+                  (minus, 1.5, None), (accumulate, 1.0, [0.5, 'x']), (divide, 1.0, 0.0)):
+    assert raised(falcon.wrap(f), a, b) is raised(f, a, b), (f.__name__, a, b)
@@ -1,4 +1,5 @@
-from testing_helpers import wrap
+import falcon
+from testing_helpers import wrap, compiles, check_raises
 
 class Foo(object):
   def __init__(self):
@@ -29,3 +30,283 @@ def store_load_attr(a,b):
 def test_store_load_attr():
   store_load_attr(0, 10)
 
+
+
+class Plain(object):
+  def __init__(self):
+    self.x = 'plain'
+
+class Shadowed(object):
+  def __init__(self):
+    self.__dict__['x'] = 'dict'
+
+  @property
+  def x(self):
+    return 'property'
+
+def read_x(objs):
+  return [o.x for o in objs]
+
+@wrap
+def descriptor_precedence(n):
+  # One site sees instances with the same dictionary layout, only one of
+  # which has a data descriptor in the way.
+  objs = [Plain(), Shadowed()] * n
+  results = read_x(objs)
+  class Late(object):
+    def __init__(self):
+      self.x = 'dict'
+  late = Late()
+  results += read_x([late, late])
+  Late.x = property(lambda self: 'added')
+  return results + read_x([late, late])
+
+def test_descriptor_precedence():
+  descriptor_precedence(3)
+
+def read_one(o):
+  return o.x
+
+def test_changed_descriptors():
+  # The descriptor's own class changes, which the owner's version tag
+  # doesn't see.
+  class D(object):
+    def __get__(self, obj, type=None):
+      return 'descr'
+
+  class Owner(object):
+    x = D()
+
+  assert compiles(read_one)
+  wrapped = falcon.wrap(read_one)
+  o = Owner()
+  o.__dict__['x'] = 'inst'
+  assert wrapped(o) == read_one(o) == 'inst'
+  D.__set__ = lambda self, obj, value: None
+  assert wrapped(o) == read_one(o) == 'descr'
+  del D.__get__
+  assert wrapped(o) == read_one(o) == 'inst'
+  del o.__dict__['x']
+  assert wrapped(o) is read_one(o) is Owner.__dict__['x']
+
+  class Both(object):
+    def __get__(self, obj, type=None):
+      return 'descr'
+    def __set__(self, obj, value):
+      pass
+
+  class Other(object):
+    x = Both()
+
+  o = Other()
+  assert wrapped(o) == read_one(o) == 'descr'
+  del Both.__get__
+  assert wrapped(o) is read_one(o) is Other.__dict__['x']
+
+def test_hint_stats():
+  objs = [Plain()] * 10
+  falcon.wrap(read_x)(objs)
+  stats = falcon.hint_stats(read_x)
+  if not stats:
+    # Built without GETATTR_HINTS.
+    return
+  sites = [site for site in stats if site['name'] == 'x']
+  assert len(sites) == 1, stats
+  site = sites[0]
+  assert site['op'] == 'LOAD_ATTR' and site['hits'] >= 9 and site['misses'] >= 1, stats
+
+
+class Base(object):
+  limit = 10
+
+  def method(self):
+    return 'base'
+
+  @classmethod
+  def make(cls):
+    return cls.__name__
+
+  @staticmethod
+  def static():
+    return 'static'
+
+  @property
+  def prop(self):
+    return self.limit * 2
+
+  @property
+  def broken(self):
+    raise AttributeError('broken')
+
+class Derived(Base):
+  pass
+
+@wrap
+def read_class_attrs(objs):
+  results = []
+  for o in objs:
+    results.append((o.limit, o.method(), o.make(), o.static(), o.prop, o.method.__name__))
+  return results
+
+def read_broken(o):
+  return o.broken
+
+def touch(h, n):
+  for i in range(n):
+    h.value
+
+def test_class_attributes():
+  import sys
+  assert compiles(read_class_attrs.python_fn) and compiles(read_broken) and compiles(touch)
+  token = object()
+  class Holder(object):
+    value = token
+  before = sys.getrefcount(token)
+  falcon.wrap(touch)(Holder(), 100)
+  # Registers may hold on to a few references for a while.
+  assert abs(sys.getrefcount(token) - before) < 5
+  read_class_attrs([Base(), Derived(), Derived()])
+  check_raises(read_broken, Derived())
+
+@wrap
+def read(o):
+  return o.x, o.f()
+
+def test_changed_classes():
+  # Loads see the class and its bases change after their lookups are cached.
+  assert compiles(read.python_fn)
+  class A(object):
+    x = 1
+    def f(self):
+      return 'A.f'
+  class B(A):
+    pass
+  b = B()
+  read(b)
+  A.x = 2
+  read(b)
+  B.f = lambda self: 'B.f'
+  read(b)
+  del B.f
+  A.f = lambda self: 'new A.f'
+  read(b)
+  b.x = 'instance'
+  read(b)
+  A.x = property(lambda self: 'property')
+  read(b)
+  class C(object):
+    x = 'C'
+    def f(self):
+      return 'C.f'
+  B.__bases__ = (C,)
+  read(b)
+
+
+class Setter(object):
+  def __set__(self, obj, value):
+    obj.__dict__['seen'] = value
+
+class Stored(object):
+  watched = Setter()
+
+  def __init__(self):
+    self._y = 0
+
+  @property
+  def y(self):
+    return self._y
+
+  @y.setter
+  def y(self, value):
+    self._y = value * 10
+
+class Intercepted(object):
+  def __setattr__(self, name, value):
+    object.__setattr__(self, name, (name, value))
+
+def write_attrs(objs, n):
+  for o in objs:
+    for i in range(n):
+      o.x = i
+      o.y = i
+      o.watched = i
+  return [sorted(o.__dict__.items()) for o in objs]
+
+def grown():
+  o = Stored()
+  for i in range(20):
+    setattr(o, 'filler%d' % i, i)
+  return o
+
+def check_writes(make_objs, n):
+  # Each run gets objects of its own, so falcon's stores see the same
+  # dictionaries Python's did.
+  expected = write_attrs(make_objs(), n)
+  assert falcon.wrap(write_attrs)(make_objs(), n) == expected
+
+def test_stores():
+  # The same stores replace dictionary values, grow the dictionary and go
+  # through descriptors and __setattr__.
+  assert compiles(write_attrs)
+  check_writes(lambda: [Stored(), grown(), Intercepted()], 3)
+  check_writes(lambda: [grown(), Stored()], 3)
+  Stored.x = property(lambda self: 'read only')
+  try:
+    check_raises(write_attrs, [grown()], 3)
+  finally:
+    del Stored.x
+  check_writes(lambda: [Stored()], 3)
+
+def test_store_stats():
+  objs = [Stored()]
+  falcon.wrap(write_attrs)(objs, 10)
+  sites = [site for site in falcon.hint_stats(write_attrs) if site['op'] == 'STORE_ATTR']
+  if not sites:
+    # Built without GETATTR_HINTS.
+    return
+  hits = dict((site['name'], site['hits']) for site in sites)
+  assert hits['x'] >= 8 and hits['y'] == 0 and hits['watched'] == 0, sites
+
+
+def kinds(n):
+  # Instances of n classes, with y alternately in the instance and the class.
+  objs = []
+  for i in range(n):
+    cls = type('Kind%d' % i, (object,), {'y': i} if i % 2 else {})
+    obj = cls()
+    if i % 2 == 0:
+      obj.y = -i
+    objs.append(obj)
+  return objs
+
+def sum_y(objs):
+  total = 0
+  for o in objs:
+    total += o.y
+  return total
+
+@wrap
+def polymorphic(n):
+  objs = kinds(n)
+  results = [sum_y(objs * 3)]
+  type(objs[-1]).y = 100
+  return results + [sum_y(objs), sum_y(kinds(n + 1))]
+
+def test_polymorphic():
+  polymorphic(3)
+  polymorphic(8)
+
+def read_y(objs):
+  return [o.y for o in objs]
+
+def test_megamorphic_stats():
+  f = falcon.wrap(read_y)
+  f(kinds(3) * 5)
+  sites = [site for site in falcon.hint_stats(read_y) if site['name'] == 'y']
+  if not sites:
+    # Built without GETATTR_HINTS.
+    return
+  assert sites[0]['entries'] == 3 and not sites[0]['megamorphic'], sites
+  assert f(kinds(8)) == read_y(kinds(8))
+  site = [site for site in falcon.hint_stats(read_y) if site['name'] == 'y'][0]
+  assert site['entries'] == 0 and site['megamorphic'], site
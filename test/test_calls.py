@@ -0,0 +1,169 @@
+import falcon
+import sys
+from testing_helpers import wrap, compiles, raised, check_raises
+
+
+def add(a, b):
+  return a + b
+
+def scale(x, factor=2, offset=0):
+  return x * factor + offset
+
+@wrap
+def nested_args(a, b):
+  return add(add(a, b), add(b, a)) + add(a, len([a, b]))
+
+@wrap
+def defaults(x):
+  return scale(x), scale(x, 3), scale(x, 3, 1)
+
+def test_arguments():
+  nested_args(1, 2)
+  defaults(5)
+
+
+class Point(object):
+  def __init__(self, x, y):
+    self.x = x
+    self.y = y
+
+  def shifted(self, dx, dy=0):
+    return self.x + dx, self.y + dy
+
+@wrap
+def methods(x):
+  p = Point(x, x + 1)
+  return p.shifted(1), p.shifted(add(x, 1), p.shifted(2)[0])
+
+def test_methods():
+  methods(3)
+
+
+def too_many(a):
+  return add(a, 2, 3)
+
+def too_few(a):
+  return add(a)
+
+def test_wrong_count():
+  check_raises(too_many, 1)
+  check_raises(too_few, 1)
+
+
+def bump(x, step=1):
+  return x + step
+
+@wrap
+def bumps(x):
+  return bump(x), bump(x, 2)
+
+def test_changed_defaults():
+  bumps(1)
+  bump.func_defaults = (10,)
+  try:
+    bumps(1)
+  finally:
+    bump.func_defaults = (1,)
+
+
+def captures(x, y=1):
+  def inner():
+    return x + y
+  return inner()
+
+@wrap
+def closures(a):
+  return captures(a), captures(a, a)
+
+def test_captured_arguments():
+  closures(2)
+
+
+def first(x):
+  return x + 1
+
+def second(x):
+  return x * 10
+
+def adders(n):
+  return [lambda x, i=i: x + i for i in range(n)]
+
+def call_each(fs, x):
+  # One site calling several functions, including closures sharing code.
+  return [f(x) for f in fs]
+
+def test_switching_callees():
+  assert compiles(call_each)
+  wrapped = falcon.wrap(call_each)
+  fs = [first, second, first] + adders(3)
+  assert wrapped(fs, 4) == call_each(fs, 4)
+  original = first.func_code
+  try:
+    first.func_code = second.func_code
+    assert wrapped([first], 4) == [40]
+    first.func_code = add.func_code
+    check_raises(call_each, [first], 4)
+  finally:
+    first.func_code = original
+  assert wrapped(fs, 4) == call_each(fs, 4)
+
+def add_constant(x):
+  return x + 987654321
+
+def test_constant_refcounts():
+  # Frames borrow their constants from the code object.
+  const = [c for c in add_constant.func_code.co_consts if c == 987654321][0]
+  before = sys.getrefcount(const)
+  wrapped = falcon.wrap(add_constant)
+  for i in range(100):
+    assert wrapped(i) == i + 987654321
+  assert sys.getrefcount(const) == before
+
+def test_call_stats():
+  if not falcon.hint_stats(bump):
+    # Built without GETATTR_HINTS: call sites don't cache their callees.
+    return
+  before = falcon.call_stats()
+  bumps(1)
+  bumps(1)
+  after = falcon.call_stats()
+  assert after['hits'] > before['hits']
+  assert after['misses'] >= before['misses']
+
+
+def keyword_only(a, b=1):
+  return a
+
+def bad_keyword(items):
+  # Sized so the registers the failed call bound are the ones past
+  # loop_over_range's argument window.
+  p0 = p1 = p2 = p3 = p4 = None
+  return keyword_only(items[0], c=1)
+
+def pairs(start, stop):
+  return [[start] * 3, [stop] * 3]
+
+def noop():
+  pass
+
+def loop_over_range():
+  # With range rebound, SETUP_RANGE calls it with more arguments than
+  # noop() needs the argument window for.
+  result = [i for i in range(10, 20)]
+  noop()
+  return result
+
+def test_range_through_window():
+  global range
+  assert compiles(bad_keyword) and compiles(loop_over_range)
+  item = object()
+  items = [item]
+  before = sys.getrefcount(item)
+  range = pairs
+  try:
+    for i in xrange(50):
+      assert raised(falcon.wrap(bad_keyword), items) == raised(bad_keyword, items)
+      assert falcon.wrap(loop_over_range)() == [[10] * 3, [20] * 3]
+  finally:
+    del range
+  assert sys.getrefcount(item) == before
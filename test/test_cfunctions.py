@@ -0,0 +1,48 @@
+from testing_helpers import wrap, check_raises
+
+
+@wrap
+def direct_calls(l, d):
+  # METH_NOARGS, METH_O, METH_VARARGS and METH_VARARGS | METH_KEYWORDS.
+  items = list(l)
+  return (items.pop(), len(items), abs(-3), d.get('a'), isinstance(d, dict), max(3, 4, 1), getattr(d, 'get')('b'),
+          sorted(items), round(2.5, 0))
+
+def no_len():
+  return len()
+
+def len_two(a, b):
+  return len(a, b)
+
+def no_abs():
+  return abs()
+
+def abs_keyword(x):
+  return abs(x=x)
+
+def pop_two(l):
+  return l.pop(1, 2)
+
+def test_direct_calls():
+  direct_calls([1, 2, 3], {'a': 1})
+
+def test_bad_counts():
+  check_raises(no_len)
+  check_raises(len_two, [], [])
+  check_raises(no_abs)
+  check_raises(abs_keyword, -1)
+  check_raises(pop_two, [])
+
+
+@wrap
+def larger(x):
+  return max(x, 2)
+
+@wrap
+def reentrant(l):
+  # map calls back into compiled code, which makes C calls of its own with
+  # the same number of arguments.
+  return map(larger, l), max(map(larger, l), [0]), min(1, 2)
+
+def test_reentrant():
+  reentrant([1, 2, 3])
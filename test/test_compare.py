@@ -25,4 +25,38 @@ def test_compare_tuples():
 def test_compare_strings():
   compare("hello", "hello")
   compare("hello", "hello2")
-  compare("hello", "hell")
\ No newline at end of file
+  compare("hello", "hell")
+
+@wrap
+def compare_ops(a, b):
+  r = []
+  if a < b: r.append('lt')
+  if a <= b: r.append('le')
+  if a == b: r.append('eq')
+  if a != b: r.append('ne')
+  if not a > b: r.append('not gt')
+  if not a >= b: r.append('not ge')
+  if a is b: r.append('is')
+  if a is not None: r.append('is not')
+  return r
+
+def test_compare_branch():
+  compare_ops(1, 2)
+  compare_ops(2, 2)
+  compare_ops(1.5, 0.5)
+  compare_ops(1.0, 1)
+  compare_ops(float('nan'), 1.0)
+  compare_ops(None, None)
+  compare_ops("a", "b")
+
+@wrap
+def compare_in(a, b):
+  if a in b:
+    return 1
+  if a not in b:
+    return 2
+
+def test_compare_in():
+  compare_in(1, [1, 2])
+  compare_in(3, (1, 2))
+  compare_in('x', 'xyz')
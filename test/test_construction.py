@@ -0,0 +1,103 @@
+from testing_helpers import wrap, compiles, check_raises
+
+
+class Point(object):
+  def __init__(self, x, y=0, *rest, **kw):
+    self.x = x
+    self.y = y
+    self.rest = rest
+    self.kw = sorted(kw.items())
+
+  def coords(self):
+    return self.x, self.y, self.rest, self.kw
+
+class Point3(Point):
+  def __init__(self, x, y, z):
+    Point.__init__(self, x, y)
+    self.z = z
+
+class Slotted(object):
+  __slots__ = ['a', 'b']
+
+  def __init__(self, a, b):
+    self.a = a
+    self.b = b
+
+class Plain(object):
+  pass
+
+class Fresh(object):
+  def __new__(cls, *args):
+    return 'new'
+
+  def __init__(self):
+    raise AssertionError('never called')
+
+class Meta(type):
+  def __call__(cls, *args):
+    return args
+
+class Custom(object):
+  __metaclass__ = Meta
+
+  def __init__(self):
+    raise AssertionError('never called')
+
+@wrap
+def constructed(n):
+  points = [Point(i) for i in range(n)]
+  return ([p.coords() for p in points], Point(1, 2, 3, a=4).coords(), Point(*[5], **{'y': 6}).coords(),
+          Point3(1, 2, 3).z, Slotted(1, 2).b, type(Plain()).__name__, Fresh(), Custom(1, 2))
+
+def test_constructed():
+  constructed(3)
+
+
+class Bad(object):
+  def __init__(self, result):
+    self.result = result
+    return result
+
+def make_bad(result):
+  return Bad(result).result
+
+def make_bad2(a, b):
+  return Bad(a, b)
+
+def make_bad0():
+  return Bad()
+
+def make_point():
+  return Point()
+
+def test_bad_constructors():
+  for f in make_bad, make_bad2, make_bad0, make_point:
+    assert compiles(f), f.__name__
+  check_raises(make_bad, 1)
+  check_raises(make_bad, 'x')
+  check_raises(make_bad2, 1, 2)
+  check_raises(make_bad0)
+  check_raises(make_point)
+  wrap(make_bad)(None)
+
+
+def init_twice(self):
+  self.n = 2
+
+@wrap
+def make_n(cls):
+  obj = cls()
+  return getattr(obj, 'n', None)
+
+def test_changed_init():
+  # Construction follows the class's __init__ as it changes.
+  assert compiles(make_n.python_fn)
+  class Changing(object):
+    def __init__(self):
+      self.n = 1
+  make_n(Changing)
+  make_n(Changing)
+  Changing.__init__ = init_twice
+  make_n(Changing)
+  del Changing.__init__
+  make_n(Changing)
@@ -0,0 +1,48 @@
+import falcon
+from testing_helpers import compiles, check_raises
+
+
+LIMIT = 3
+
+def reads(n):
+  total = 0
+  for i in range(n):
+    total += LIMIT + len([i])
+  return total
+
+def test_rebound():
+  # The same loads see globals change, appear, shadow builtins and go away.
+  global LIMIT
+  assert compiles(reads)
+  wrapped = falcon.wrap(reads)
+  g = globals()
+  assert wrapped(5) == reads(5)
+  try:
+    LIMIT = 4
+    assert wrapped(5) == reads(5)
+    g['len'] = lambda x: 100
+    assert wrapped(5) == reads(5)
+    del g['len']
+    assert wrapped(5) == reads(5)
+    for i in range(100):
+      g['filler%d' % i] = i
+    assert wrapped(5) == reads(5)
+  finally:
+    g.pop('len', None)
+    for i in range(100):
+      g.pop('filler%d' % i, None)
+    LIMIT = 3
+  assert wrapped(5) == reads(5)
+
+
+def missing():
+  return undefined_name
+
+def test_undefined():
+  global undefined_name
+  for i in range(3):
+    check_raises(missing)
+  undefined_name = 1
+  assert falcon.wrap(missing)() == 1
+  del undefined_name
+  check_raises(missing)
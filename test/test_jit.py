@@ -0,0 +1,69 @@
+import falcon
+
+def check(f, *args):
+  expected = f(*args)
+  jitted = falcon.jit(f)
+  result = jitted(*args)
+  assert expected == result, \
+    "%s failed: expected %s but got %s" % (f.__name__, expected, result)
+
+def loops(n):
+  total = 0
+  for i in range(n):
+    if i % 3 == 0:
+      total += i
+    elif i > n / 2:
+      total -= 1
+  j = 0
+  while j < n:
+    j += 2
+  return total, j
+
+def calls(n):
+  l = []
+  for i in range(n):
+    l.append(abs(i - n))
+  return sorted(l)[:3], max(l), [x * 2 for x in l if x & 1]
+
+def floats(a, b):
+  r = 0.0
+  while a < b:
+    r += a * 0.5
+    a += 1.0
+  return r
+
+def raises(n):
+  return [1, 2, 3][n]
+
+def test_jit_loops():
+  check(loops, 0)
+  check(loops, 100)
+
+def test_jit_calls():
+  check(calls, 10)
+
+def test_jit_floats():
+  check(floats, 0.5, 10.0)
+
+def test_jit_compile():
+  if not falcon.evaluator.jit_available():
+    assert not falcon.evaluator.jit_compile(loops)
+    return
+  assert falcon.evaluator.jit_compile(loops)
+  check(loops, 100)
+
+def test_jit_release():
+  # Native code goes with the evaluator which compiled it.
+  for i in range(100):
+    evaluator = falcon.Evaluator()
+    assert evaluator.jit_compile(loops) == evaluator.jit_available()
+    assert evaluator.eval_python(loops, (100,), {}) == loops(100)
+    del evaluator
+
+def test_jit_exception():
+  check(raises, 1)
+  try:
+    falcon.jit(raises)(5)
+    assert False, "Expected IndexError"
+  except IndexError:
+    pass
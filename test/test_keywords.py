@@ -0,0 +1,99 @@
+import falcon
+import sys
+from testing_helpers import wrap, check_raises
+
+
+def point(x, y=2, z=3):
+  return x * 100 + y * 10 + z
+
+@wrap
+def keywords(a):
+  total = 0
+  for i in range(3):
+    total += point(a, z=i) + point(y=i, x=a) + point(a, 1, z=i)
+  return total
+
+def test_keywords():
+  keywords(1)
+
+
+class Counter(object):
+  def __init__(self):
+    self.n = 0
+
+  def add(self, amount=1, times=1):
+    self.n += amount * times
+    return self.n
+
+@wrap
+def method_keywords():
+  c = Counter()
+  c.add(times=3)
+  c.add(2, times=2)
+  return c.add(amount=5)
+
+def test_method_keywords():
+  method_keywords()
+
+
+def unknown_keyword(a):
+  return point(a, w=2)
+
+def repeated_keyword(a):
+  return point(a, x=2)
+
+def missing_positional(a):
+  return point(y=a)
+
+def repeated_method_keyword(c):
+  return c.add(3, amount=1)
+
+def test_bad_keywords():
+  check_raises(unknown_keyword, 1)
+  check_raises(repeated_keyword, 1)
+  check_raises(missing_positional, 1)
+  check_raises(repeated_method_keyword, Counter())
+
+
+def forward_order(a, b):
+  return a * 10 + b
+
+def reverse_order(b, a):
+  return a * 100 + b
+
+def ordered(f):
+  return f(a=1, b=2)
+
+def test_keyword_callees():
+  # One site, whose keywords bind to different parameters for each callee.
+  wrapped = falcon.wrap(ordered)
+  for f in [forward_order, reverse_order] * 3:
+    assert wrapped(f) == ordered(f)
+  original = forward_order.func_code
+  try:
+    forward_order.func_code = reverse_order.func_code
+    assert wrapped(forward_order) == 102
+  finally:
+    forward_order.func_code = original
+  assert wrapped(forward_order) == 12
+
+
+BIG = 123456789
+
+def big_default(a, b=BIG):
+  return b
+
+def test_keyword_refcounts():
+  # Keyword-bound calls borrow the defaults and keyword values they bind.
+  value = BIG + 1
+  before = sys.getrefcount(BIG), sys.getrefcount(value)
+  wrapped = falcon.wrap(big_default)
+  for i in range(100):
+    assert wrapped(a=1) == BIG
+    assert wrapped(a=1, b=value) == value
+  assert (sys.getrefcount(BIG), sys.getrefcount(value)) == before
+
+
+def test_entry_keywords():
+  assert falcon.wrap(point)(1, z=5) == point(1, z=5)
+  assert falcon.wrap(point)(y=0, x=1) == point(y=0, x=1)
@@ -10,4 +10,68 @@ def count_threshold(limit, threshold):
 def test_count_threshold():
   count_threshold(1000, 50)
   
-  
\ No newline at end of file
+  
+@wrap
+def range_loops(n, lo):
+  total = 0
+  for i in range(n):
+    total += i
+  for i in xrange(lo, n):
+    n -= 1
+    total += i
+  for i in xrange(n, lo):
+    total += 1000
+  return total
+
+def test_range_loops():
+  range_loops(100, 10)
+  range_loops(0, -5)
+
+@wrap
+def range_near_maxint(n):
+  total = 0
+  for i in xrange(n - 3, n):
+    total += i
+  return total
+
+def test_range_near_maxint():
+  import sys
+  range_near_maxint(sys.maxint)
+
+def shadowed(n):
+  xrange = lambda n: [n] * 3
+  total = 0
+  for i in xrange(n):
+    total += i
+  return total
+
+@wrap
+def range_rebound(n):
+  return [i for i in xrange(n)]
+
+def test_range_rebound():
+  wrap(shadowed)(7)
+  global xrange
+  xrange = lambda n: ['a'] * n
+  try:
+    range_rebound(3)
+  finally:
+    del xrange
+  range_rebound(3L)
+
+@wrap
+def nested_whiles(limit, n):
+  t = 0
+  j = 0
+  while j < limit and t < n:
+    j += 1
+    t += 1
+  while t < n:
+    j = 0
+    while j < limit and t < n:
+      j += 1
+      t += 1
+  return j, t
+
+def test_nested_whiles():
+  nested_whiles(4, 18)
@@ -0,0 +1,86 @@
+import falcon
+from testing_helpers import wrap, compiles, check_raises
+
+
+class Counter(object):
+  def __init__(self, start):
+    self.n = start
+
+  def bump(self, step=1):
+    self.n += step
+    return self.n
+
+  @classmethod
+  def make(cls, start):
+    return cls(start)
+
+  @staticmethod
+  def twice(x):
+    return 2 * x
+
+class Shouting(Counter):
+  def bump(self, step=1):
+    return Counter.bump(self, step * 10)
+
+class Dynamic(object):
+  def __getattr__(self, name):
+    return lambda *args: (name, args)
+
+class OldStyle:
+  def greet(self, who):
+    return 'hi ' + who
+
+@wrap
+def python_methods(start):
+  c = Counter(start)
+  return c.bump(), c.bump(2), c.bump(step=c.bump()), Shouting(1).bump(), Counter.make(3).bump()
+
+def test_python_methods():
+  python_methods(0)
+
+
+def other_attributes(c):
+  return c.bump(4), Counter.twice(4), c.twice(5), Dynamic().anything(1, 2), OldStyle().greet('you')
+
+def test_other_attributes():
+  assert compiles(other_attributes)
+  wrapped = falcon.wrap(other_attributes)
+  # Two counters, as bump changes them.
+  c, expected = Counter(0), Counter(0)
+  assert wrapped(c) == other_attributes(expected)
+  for o in (c, expected):
+    o.bump = lambda step=1: -step
+  assert wrapped(c) == other_attributes(expected)
+  for o in (c, expected):
+    del o.bump
+  assert wrapped(c) == other_attributes(expected)
+
+
+class Items(list):
+  def count(self, x):
+    return -1
+
+@wrap
+def c_methods(d, s):
+  l = [3, 1]
+  l.append(len(l))
+  l.extend([1, 2])
+  l.sort(reverse=True)
+  return l.pop(), l.count(1), d.get('a'), d.get('b', 2), d.keys(), s.split(','), s.upper(), Items().count(1)
+
+def append_two(l):
+  return l.append(1, 2)
+
+def pop_three(l):
+  return l.pop(1, 2, 3)
+
+def append_keyword(l):
+  return l.append(x=1)
+
+def test_c_methods():
+  c_methods({'a': 1}, 'a,b')
+
+def test_c_method_errors():
+  check_raises(append_two, [])
+  check_raises(pop_three, [])
+  check_raises(append_keyword, [])
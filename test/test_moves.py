@@ -0,0 +1,54 @@
+from testing_helpers import wrap
+
+
+@wrap
+def copy_then_rebind(b):
+  a = b
+  b = 5
+  return a
+
+def test_copy_then_rebind():
+  copy_then_rebind(3)
+
+
+@wrap
+def swap(a, b):
+  a, b = b, a
+  return a - b
+
+@wrap
+def rotate(x, y, z):
+  for i in range(4):
+    x, y, z = y, z, x
+  return x, y, z
+
+def test_swap():
+  swap(1, 2)
+  rotate(1, 2, 3)
+
+
+@wrap
+def fib(n):
+  x = 0
+  y = 1
+  while n > 0:
+    x, y = y, x + y
+    n -= 1
+  return x
+
+def test_loop_carried():
+  fib(20)
+
+
+def make_list():
+  return [1]
+
+@wrap
+def joins(a, b, c):
+  x = a or make_list()
+  y = (a if c else b) + (b if c else a)
+  return x, y, [a, b, (b if c else a)]
+
+def test_joins():
+  joins(0, 2, False)
+  joins(1, 2, True)
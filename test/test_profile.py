@@ -0,0 +1,23 @@
+import falcon
+from testing_helpers import wrap
+
+@wrap
+def count_up(n):
+  t = 0
+  for i in range(n):
+    t += i
+  return t
+
+def test_profile():
+  falcon.clear_profile()
+  falcon.enable_profiling()
+  try:
+    count_up(100)
+  finally:
+    falcon.enable_profiling(False)
+  profile = falcon.op_profile()
+  assert profile['counts']['INPLACE_ADD'] == 100, profile['counts']
+  assert profile['pairs'], profile
+  falcon.clear_profile()
+  count_up(100)
+  assert not falcon.op_profile()['counts']
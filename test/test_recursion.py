@@ -0,0 +1,30 @@
+import sys
+import falcon
+from testing_helpers import wrap, compiles, check_raises
+
+def depth(n):
+  if n == 0:
+    return 0
+  return 1 + depth(n - 1)
+
+wrapped_depth = wrap(depth)
+
+def test_deep_recursion():
+  limit = sys.getrecursionlimit()
+  sys.setrecursionlimit(10000)
+  try:
+    wrapped_depth(5000)
+  finally:
+    sys.setrecursionlimit(limit)
+
+
+def lookup(d, k):
+  return d[k]
+
+def find(d, k):
+  return lookup(d, k)
+
+def test_exception_across_calls():
+  assert compiles(find)
+  assert falcon.wrap(find)({1: 2}, 1) == 2
+  check_raises(find, {1: 2}, 0)
@@ -1,5 +1,6 @@
 
-from testing_helpers import wrap 
+import falcon
+from testing_helpers import wrap, check_raises
 
 
 @wrap 
@@ -19,4 +20,36 @@ def add_tuples(x,y):
   return a + b
 
 def test_add_tuples():
-  add_tuples(20,309.0)
\ No newline at end of file
+  add_tuples(20,309.0)
+
+@wrap
+def unpack_pairs(items):
+  total = 0
+  for k, v in items:
+    total += k * v
+  a, b, c, d = items[0] + items[1]
+  return total, a, b, c, d
+
+def test_unpack_pairs():
+  unpack_pairs([(1, 2), (3, 4)])
+  unpack_pairs([[1, 2], [3, 4]])
+  unpack_pairs({1: 2, 3: 4}.items())
+
+
+@wrap
+def unpack_iterable(x):
+  a, b, c = x
+  x, y = a, b
+  return a, b, c, x, y
+
+def unpack_pair(x):
+  a, b = x
+  return a + b
+
+def test_unpack_iterable():
+  unpack_iterable('abc')
+  unpack_iterable(xrange(3))
+  assert falcon.wrap(unpack_pair)((1, 2)) == 3
+  assert falcon.wrap(unpack_pair)(iter([1, 2])) == 3
+  for x in ((1, 2, 3), [1], '', xrange(3), 5, None):
+    check_raises(unpack_pair, x)
@@ -0,0 +1,90 @@
+import sys
+import falcon
+from testing_helpers import wrap, raised, check_raises
+
+
+def collect(a, *args, **kw):
+  return a, args, sorted(kw.items())
+
+def area(width, height=1):
+  return width * height
+
+def forward(*args, **kw):
+  return area(*args, **kw)
+
+def logged(f):
+  def wrapper(*args, **kw):
+    return f(*args, **kw)
+  return wrapper
+
+@logged
+def shifted(x, dx=0, dy=0):
+  return x + dx + dy
+
+@wrap
+def star_calls(xs):
+  return area(*xs), area(2, *[3]), area(*(x for x in xs)), len(*[xs])
+
+@wrap
+def kwarg_calls(kw):
+  return area(**kw), area(2, **{'height': 5}), dict(a=1, **kw)
+
+def test_unpacked_calls():
+  star_calls((2, 3))
+  kwarg_calls({'width': 4, 'height': 2})
+
+
+@wrap
+def collected(x):
+  return collect(x), collect(x, 1, 2), collect(x, b=2), collect(x, 1, a2=2, *[3], **{'c': 4})
+
+@wrap
+def forwarding(x):
+  return forward(x), forward(x, height=3), forward(**{'width': x}), shifted(x, 1, dy=2)
+
+def test_collected():
+  collected(1)
+  forwarding(3)
+
+
+def star_area(xs):
+  return area(*xs)
+
+def starstar_area(kw):
+  return area(**kw)
+
+def repeated_width(x):
+  return area(x, width=2)
+
+def repeated_collected(x):
+  return collect(x, a=2)
+
+def forward_unknown(x):
+  return forward(x, nope=2)
+
+def failing():
+  yield 1
+  raise TypeError('not the call')
+
+def test_bad_unpacking():
+  check_raises(star_area, 5)
+  check_raises(star_area, None)
+  assert raised(falcon.wrap(star_area), failing()) == (TypeError, 'not the call')
+  check_raises(starstar_area, [1])
+  check_raises(repeated_width, 1)
+  check_raises(repeated_collected, 1)
+  check_raises(forward_unknown, 1)
+
+
+BIG = 123456789
+
+def test_unpacked_refcounts():
+  # The unpacked arguments are borrowed from the tuple and dict they came from.
+  value = BIG + 1
+  before = sys.getrefcount(BIG), sys.getrefcount(value)
+  star = falcon.wrap(star_area)
+  starstar = falcon.wrap(starstar_area)
+  for i in range(100):
+    assert star((BIG, 1)) == BIG
+    assert starstar({'width': value}) == value
+  assert (sys.getrefcount(BIG), sys.getrefcount(value)) == before
@@ -13,3 +13,28 @@ class wrap(object):
     falcon_result = self.falcon_fn(*args, **kwargs)
     assert python_result == falcon_result, \
       "%s failed: expected %s but got  %s" % (self.name, python_result, falcon_result) 
+
+def compiles(f):
+  '''Whether falcon compiles f, rather than leaving it to Python.'''
+  try:
+    falcon.hint_stats(f)
+    return True
+  except ValueError:
+    return False
+
+def raised(f, *args, **kwargs):
+  '''The type and message of the exception f raises, or None.'''
+  try:
+    f(*args, **kwargs)
+  except Exception, e:
+    return type(e), str(e)
+  return None
+
+def check_raises(f, *args, **kwargs):
+  '''Checks that falcon compiles f, and that it raises the exception Python
+  does, with the same message.'''
+  assert compiles(f), '%s is not compiled' % f.__name__
+  expected = raised(f, *args, **kwargs)
+  assert expected is not None, '%s raised nothing' % f.__name__
+  got = raised(falcon.wrap(f), *args, **kwargs)
+  assert got == expected, '%s failed: expected %s but got %s' % (f.__name__, expected, got)